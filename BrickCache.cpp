@@ -0,0 +1,421 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BrickCache.h"
+
+namespace {
+
+// File layout: a HEADER padded to HEADER_SIZE bytes, then the bricks in
+// x-fastest order of their brick coordinates, each one GetBrickEdge()^3
+// native endian floats in x-fastest order.
+const char MAGIC[8] = {'V', 'R', 'I', 'B', 'R', 'I', 'C', 'K'};
+const uint32_t VERSION = 1;
+const size_t HEADER_SIZE = 64;
+
+struct HEADER {
+	char magic[8];
+	uint32_t version;
+	uint32_t size[3];
+	uint32_t brickSize;
+};
+
+inline int ClampIndex(int i, int size)
+{
+	return std::min(std::max(i, 0), size - 1);
+}
+
+}
+
+/**
+*/
+CBrickCache::CBrickCache(void)
+	: m_file(-1), m_brickSize(0), m_capacity(0), m_stop(false)
+{
+	m_size[0] = m_size[1] = m_size[2] = 0;
+	m_bricks[0] = m_bricks[1] = m_bricks[2] = 0;
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+/**
+*/
+CBrickCache::~CBrickCache(void)
+{
+	Close();
+}
+
+/**
+Writes the voxels of image, which must be open, as a brick file. The volume
+is read one slab of bricks at a time, so image can be mapped rather than
+resident. The file is written next to path and renamed when complete.
+*/
+bool CBrickCache::Create(const CGageAdaptor& image, const std::string& path, unsigned int brickSize)
+{
+	const void *data = image.GetValueArray();
+	const int type = image.GetType();
+	const int size[3] = {image.GetWidth(), image.GetHeight(), image.GetDepth()};
+
+	if (!data || brickSize == 0 || !size[0] || !size[1] || !size[2])
+	{
+		return false;
+	}
+
+	const std::string temporary = path + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (!file)
+	{
+		std::cerr << "cannot create " << temporary << "..." << std::endl;
+		return false;
+	}
+
+	char header[HEADER_SIZE];
+	HEADER fields;
+	memset(header, 0, sizeof(header));
+	memcpy(fields.magic, MAGIC, sizeof(MAGIC));
+	fields.version = VERSION;
+	for (unsigned int a = 0; a < 3; ++a)
+		fields.size[a] = size[a];
+	fields.brickSize = brickSize;
+	memcpy(header, &fields, sizeof(fields));
+
+	bool status = fwrite(header, sizeof(header), 1, file) == 1;
+
+	const int B = (int)brickSize;
+	const int edge = B + APRON_LOW + APRON_HIGH;
+	const int bricks[3] = {(size[0] + B - 1) / B, (size[1] + B - 1) / B, (size[2] + B - 1) / B};
+	const size_t sx = size[0];
+	const size_t sxy = sx * size[1];
+	std::vector<float> voxels((size_t)edge * edge * edge);
+
+	for (int bz = 0; status && bz < bricks[2]; ++bz)
+	{
+		for (int by = 0; status && by < bricks[1]; ++by)
+		{
+			for (int bx = 0; status && bx < bricks[0]; ++bx)
+			{
+				float *voxel = &voxels[0];
+				for (int k = 0; k < edge; ++k)
+				{
+					const size_t z = ClampIndex(bz * B - APRON_LOW + k, size[2]);
+					for (int j = 0; j < edge; ++j)
+					{
+						const size_t y = ClampIndex(by * B - APRON_LOW + j, size[1]);
+						for (int i = 0; i < edge; ++i)
+						{
+							const size_t x = ClampIndex(bx * B - APRON_LOW + i, size[0]);
+							*voxel++ = (float)nrrdDLookup[type](data, z * sxy + y * sx + x);
+						}
+					}
+				}
+
+				status = fwrite(&voxels[0], sizeof(float), voxels.size(), file) == voxels.size();
+			}
+		}
+	}
+
+	status = !fclose(file) && status;
+
+	if (!status || rename(temporary.c_str(), path.c_str()))
+	{
+		std::cerr << "writing " << path << " failed..." << std::endl;
+		remove(temporary.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/**
+Opens a brick file written by Create, keeping at most capacity bytes of bricks
+in memory (and at least one brick).
+*/
+bool CBrickCache::Open(const std::string& path, size_t capacity)
+{
+	if (IsOpen())
+		Close();
+
+	if ((m_file = open(path.c_str(), O_RDONLY)) < 0)
+	{
+		return false;
+	}
+
+	char header[HEADER_SIZE];
+	HEADER fields;
+	struct stat info;
+
+	bool status = pread(m_file, header, sizeof(header), 0) == (ssize_t)sizeof(header);
+	memcpy(&fields, header, sizeof(fields));
+
+	status = status
+	      && !memcmp(fields.magic, MAGIC, sizeof(MAGIC))
+	      && fields.version == VERSION
+	      && fields.brickSize > 0
+	      && !fstat(m_file, &info);
+
+	if (status)
+	{
+		m_brickSize = (int)fields.brickSize;
+		for (unsigned int a = 0; a < 3; ++a)
+		{
+			m_size[a] = (int)fields.size[a];
+			m_bricks[a] = (m_size[a] + m_brickSize - 1) / m_brickSize;
+		}
+
+		const size_t brickBytes = (size_t)GetBrickEdge() * GetBrickEdge() * GetBrickEdge() * sizeof(float);
+		const size_t bricks = (size_t)m_bricks[0] * m_bricks[1] * m_bricks[2];
+
+		status = (size_t)info.st_size == HEADER_SIZE + bricks * brickBytes;
+
+		m_capacity = std::max((size_t)1, capacity / brickBytes);
+	}
+
+	if (!status)
+	{
+		std::cerr << path << " is not a brick file..." << std::endl;
+		close(m_file);
+		m_file = -1;
+		return false;
+	}
+
+	memset(&m_statistics, 0, sizeof(m_statistics));
+
+	m_stop = false;
+	m_prefetcher = std::thread(&CBrickCache::PrefetchLoop, this);
+
+	return true;
+}
+
+/**
+*/
+void CBrickCache::Close(void)
+{
+	if (m_prefetcher.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_requested.notify_all();
+		m_prefetcher.join();
+	}
+
+	if (m_file >= 0)
+	{
+		close(m_file);
+		m_file = -1;
+	}
+
+	m_lru.clear();
+	m_resident.clear();
+	m_loading.clear();
+	m_requests.clear();
+}
+
+/**
+*/
+bool CBrickCache::IsOpen(void) const
+{
+	return m_file >= 0;
+}
+
+/**
+Number of voxels of the volume along axis.
+*/
+int CBrickCache::GetSize(unsigned int axis) const
+{
+	return m_size[axis];
+}
+
+/**
+Number of voxels owned by a brick along each axis.
+*/
+int CBrickCache::GetBrickSize(void) const
+{
+	return m_brickSize;
+}
+
+/**
+Number of voxels stored for a brick along each axis, aprons included.
+*/
+int CBrickCache::GetBrickEdge(void) const
+{
+	return m_brickSize + APRON_LOW + APRON_HIGH;
+}
+
+/**
+Index of the brick owning voxel (x, y, z), which must be inside the volume.
+*/
+unsigned int CBrickCache::GetBrickIndex(int x, int y, int z) const
+{
+	return ((unsigned int)(z / m_brickSize) * m_bricks[1] + (unsigned int)(y / m_brickSize)) * m_bricks[0]
+	     + (unsigned int)(x / m_brickSize);
+}
+
+/**
+Maximum number of bricks kept in memory.
+*/
+size_t CBrickCache::GetCapacity(void) const
+{
+	return m_capacity;
+}
+
+/**
+Returns the brick, reading it unless it is resident. Waits for the prefetcher
+instead of reading the brick a second time when it is already being loaded.
+*/
+CBrickCache::BRICK CBrickCache::GetBrick(unsigned int index)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (;;)
+	{
+		std::unordered_map<unsigned int, LRU::iterator>::iterator found = m_resident.find(index);
+		if (found != m_resident.end())
+		{
+			m_lru.splice(m_lru.begin(), m_lru, found->second);
+			++m_statistics.hits;
+			return found->second->second;
+		}
+
+		if (!m_loading.count(index))
+			break;
+
+		m_loaded.wait(lock);
+	}
+
+	++m_statistics.misses;
+	m_loading.insert(index);
+	lock.unlock();
+
+	BRICK brick = Read(index);
+
+	lock.lock();
+	m_loading.erase(index);
+	Insert(index, brick);
+	m_loaded.notify_all();
+
+	return brick;
+}
+
+/**
+Asks the prefetcher to load the bricks that are neither resident nor being
+loaded. Only the most recent requests are kept, at most half of the capacity,
+so that prefetching never evicts the bricks it just loaded.
+*/
+void CBrickCache::Prefetch(const unsigned int *indices, unsigned int count)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			if (m_resident.count(indices[i]) || m_loading.count(indices[i]) ||
+				std::find(m_requests.begin(), m_requests.end(), indices[i]) != m_requests.end())
+			{
+				continue;
+			}
+
+			m_requests.push_back(indices[i]);
+		}
+
+		const size_t limit = std::max((size_t)1, m_capacity / 2);
+		while (m_requests.size() > limit)
+			m_requests.pop_front();
+	}
+
+	m_requested.notify_one();
+}
+
+/**
+*/
+CBrickCache::STATISTICS CBrickCache::GetStatistics(void) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_statistics;
+}
+
+/**
+Reads a brick from the file. A brick that cannot be read is reported and
+returned filled with zeros.
+*/
+CBrickCache::BRICK CBrickCache::Read(unsigned int index)
+{
+	const size_t count = (size_t)GetBrickEdge() * GetBrickEdge() * GetBrickEdge();
+	const size_t bytes = count * sizeof(float);
+	boost::shared_ptr< std::vector<float> > brick(new std::vector<float>(count));
+
+	char *buffer = (char *)&(*brick)[0];
+	size_t done = 0;
+	while (done < bytes)
+	{
+		const ssize_t r = pread(m_file, buffer + done, bytes - done, (off_t)(HEADER_SIZE + index * bytes + done));
+		if (r <= 0)
+		{
+			std::cerr << "reading brick " << index << " failed..." << std::endl;
+			std::fill(brick->begin(), brick->end(), 0.0f);
+			break;
+		}
+		done += (size_t)r;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_statistics.bytesRead += done;
+
+	return brick;
+}
+
+/**
+Makes brick the most recently used one and evicts the least recently used
+bricks beyond the capacity. Must be called with m_mutex held.
+*/
+void CBrickCache::Insert(unsigned int index, const BRICK& brick)
+{
+	m_lru.push_front(std::make_pair(index, brick));
+	m_resident[index] = m_lru.begin();
+
+	while (m_lru.size() > m_capacity)
+	{
+		m_resident.erase(m_lru.back().first);
+		m_lru.pop_back();
+		++m_statistics.evictions;
+	}
+}
+
+/**
+*/
+void CBrickCache::PrefetchLoop(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!m_stop)
+	{
+		if (m_requests.empty())
+		{
+			m_requested.wait(lock);
+			continue;
+		}
+
+		const unsigned int index = m_requests.front();
+		m_requests.pop_front();
+
+		if (m_resident.count(index) || m_loading.count(index))
+			continue;
+
+		m_loading.insert(index);
+		lock.unlock();
+
+		BRICK brick = Read(index);
+
+		lock.lock();
+		m_loading.erase(index);
+		Insert(index, brick);
+		++m_statistics.prefetched;
+		m_loaded.notify_all();
+	}
+}
@@ -0,0 +1,93 @@
+#ifndef BRICKCACHE_INCLUDED
+#define BRICKCACHE_INCLUDED
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
+
+#include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "GageAdaptor.h"
+
+/**
+Float bricks of a scalar volume stored in a file and read on demand into a
+bounded, least recently used cache. Besides the brickSize^3 voxels it owns,
+each brick stores APRON_LOW voxels below and APRON_HIGH voxels above them
+along every axis, copied from its neighbours or bled from the border. Any
+stencil of up to four voxels whose base voxel the brick owns can thus be
+evaluated from that brick alone.
+
+A background thread loads the bricks asked for by Prefetch. One cache is
+shared by every adaptor reading the file and can be used from any thread.
+Bricks stay valid while a returned BRICK references them, even after they
+are evicted.
+*/
+class CBrickCache
+	: boost::noncopyable
+{
+public:
+	typedef boost::shared_ptr< const std::vector<float> > BRICK;
+	enum {
+		APRON_LOW = 1,
+		APRON_HIGH = 2
+	};
+	struct STATISTICS {
+		// Bricks found in the cache, or being loaded by the prefetcher.
+		uint64_t hits;
+		// Bricks the caller had to wait for the disk for.
+		uint64_t misses;
+		// Bricks loaded by the prefetcher.
+		uint64_t prefetched;
+		uint64_t evictions;
+		uint64_t bytesRead;
+	};
+	CBrickCache(void);
+	~CBrickCache(void);
+	static bool Create(const CGageAdaptor& image, const std::string& path, unsigned int brickSize);
+	bool Open(const std::string& path, size_t capacity);
+	void Close(void);
+	bool IsOpen(void) const;
+	int GetSize(unsigned int axis) const;
+	int GetBrickSize(void) const;
+	int GetBrickEdge(void) const;
+	unsigned int GetBrickIndex(int x, int y, int z) const;
+	size_t GetCapacity(void) const;
+	BRICK GetBrick(unsigned int index);
+	void Prefetch(const unsigned int *indices, unsigned int count);
+	STATISTICS GetStatistics(void) const;
+private:
+	BRICK Read(unsigned int index);
+	void Insert(unsigned int index, const BRICK& brick);
+	void PrefetchLoop(void);
+protected:
+	typedef std::list< std::pair<unsigned int, BRICK> > LRU;
+
+	int m_file;
+	int m_size[3];
+	int m_brickSize;
+	int m_bricks[3];
+	// Number of bricks kept in memory.
+	size_t m_capacity;
+
+	// Most recently used first.
+	LRU m_lru;
+	std::unordered_map<unsigned int, LRU::iterator> m_resident;
+	std::unordered_set<unsigned int> m_loading;
+	std::deque<unsigned int> m_requests;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_loaded;
+	std::condition_variable m_requested;
+	std::thread m_prefetcher;
+	bool m_stop;
+	STATISTICS m_statistics;
+};
+
+#endif // BRICKCACHE_INCLUDED
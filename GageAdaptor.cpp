@@ -39,9 +39,17 @@ marching methods. IEEE Trans. Vis Comp. Graph. 2009
 #define MY_LEAN_AND_MEAN_GAGEADAPTOR
 
 #include <cmath>
+#include <cfloat>
+#include <cstring>
 #include <iostream>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "GageAdaptor.h"
+#include "NativeSampler.h"
+#include "NormalCache.h"
 
 /**
 */
@@ -80,17 +88,28 @@ bool CGageAdaptor::Open(const std::string& path)
 		return false;
 	}
 
-	if (!CreateDefaultContext())
+	return OpenContext();
+}
+
+/**
+Like Open, but maps the voxels of raw encoded Nrrds read-only instead of
+reading them, whether the data is attached to the header or in a detached
+file. Pages are only read when probed. Nrrds that cannot be mapped
+(compressed or ascii encodings, foreign endianness, several data files) are
+loaded as Open does.
+*/
+bool CGageAdaptor::OpenMapped(const std::string& path)
+{
+	if (IsOpen())
+		Close();
+
+	if (!MapNrrd(path) && !OpenNrrd(path))
 	{
-		std::cerr << "create default context failed..." << std::endl;
+		std::cerr << "opennrrd failed..." << std::endl;
 		return false;
 	}
 
-	m_isOpen = true;
-
-	m_isCopy = false;
-
-	return true;
+	return OpenContext();
 }
 
 /**
@@ -105,16 +124,89 @@ bool CGageAdaptor::OpenFromMemory(void *data, VALUE_TYPE type, unsigned int widt
 		return false;
 	}
 
-	if (!CreateDefaultContext())
+	return OpenContext();
+}
+
+/**
+Like OpenFromMemory, but without copying: the adaptor probes the caller's
+buffer, which must outlive it (and its clones) and must not change while
+open.
+*/
+bool CGageAdaptor::OpenFromExternalMemory(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth)
+{
+	if (IsOpen())
+		Close();
+
+	if (!WrapNrrd(data, type, width, height, depth))
 	{
 		return false;
 	}
 
-	m_isOpen = true;
+	return OpenContext();
+}
 
-	m_isCopy = false;
+/**
+Returns an adaptor with its own gage context and answer buffers over the same
+Nrrd, so each thread can probe its own clone without locking. The voxel data
+is not copied: the clone borrows this adaptor's Nrrd and kernels, and this
+adaptor must stay open while the clone is in use. Kernels and queries must be
+set before cloning; the clone cannot change them.
+*/
+boost::shared_ptr<CGageAdaptor> CGageAdaptor::Clone(void) const
+{
+	boost::shared_ptr<CGageAdaptor> copy;
 
-	return true;
+	if (!IsOpen())
+	{
+		return copy;
+	}
+
+	copy.reset(new CGageAdaptor);
+
+	if (!(copy->m_measurementContext = gageContextCopy(m_measurementContext)))
+	{
+		std::cerr << "gageContextCopy failed..." << std::endl;
+		std::cerr << biffGetDone(GAGE) << std::endl;
+		return boost::shared_ptr<CGageAdaptor>();
+	}
+
+	copy->m_imageHandle = m_imageHandle;
+	copy->m_imageInfo = copy->m_measurementContext->pvl[0];
+	copy->m_isOpen = true;
+	copy->m_isCopy = true;
+	copy->m_doClamp = m_doClamp;
+	copy->m_sampler.reset(new CNativeSampler(*m_sampler));
+	copy->m_normalCache = m_normalCache;
+	copy->m_valueKernel = m_valueKernel;
+	memcpy(copy->m_valueKernelParameters, m_valueKernelParameters, sizeof(m_valueKernelParameters));
+
+	gageContext *context = copy->m_measurementContext;
+	gagePerVolume *info = copy->m_imageInfo;
+
+	if (m_valuePointer)
+		copy->m_valuePointer = gageAnswerPointer(context, info, gageSclValue);
+	if (m_normalPointer)
+		copy->m_normalPointer = gageAnswerPointer(context, info, gageSclNormal);
+	if (m_gradientPointer)
+		copy->m_gradientPointer = gageAnswerPointer(context, info, gageSclGradVec);
+	if (m_gradientMagnitudePointer)
+		copy->m_gradientMagnitudePointer = gageAnswerPointer(context, info, gageSclGradMag);
+	if (m_hessianPointer)
+		copy->m_hessianPointer = gageAnswerPointer(context, info, gageSclHessian);
+	if (m_laplacianPointer)
+		copy->m_laplacianPointer = gageAnswerPointer(context, info, gageSclLaplacian);
+	if (m_hessian1stEigenvaluePointer)
+		copy->m_hessian1stEigenvaluePointer = gageAnswerPointer(context, info, gageSclHessEval0);
+	if (m_hessian2ndEigenvaluePointer)
+		copy->m_hessian2ndEigenvaluePointer = gageAnswerPointer(context, info, gageSclHessEval1);
+	if (m_hessian3rdEigenvaluePointer)
+		copy->m_hessian3rdEigenvaluePointer = gageAnswerPointer(context, info, gageSclHessEval2);
+	if (m_1stPrincipleCurvaturePointer)
+		copy->m_1stPrincipleCurvaturePointer = gageAnswerPointer(context, info, gageSclK1);
+
+	copy->UpdateAnswer();
+
+	return copy;
 }
 
 /**
@@ -130,6 +222,9 @@ void CGageAdaptor::Close(void)
 		m_imageInfo = 0;
 	}
 
+	// A copied context owns its copied gagePerVolume.
+	m_imageInfo = 0;
+
 	if (m_measurementContext)
 	{
 		free(gageContextNix(m_measurementContext));
@@ -137,13 +232,34 @@ void CGageAdaptor::Close(void)
 		m_measurementContext = 0;
 	}
 
+	// Clones borrow the Nrrd of the adaptor they were made from.
 	if (m_imageHandle)
 	{
-		nrrdNuke(m_imageHandle);
+		if (!m_isCopy)
+		{
+			if (m_ownsData)
+				nrrdNuke(m_imageHandle);
+			else
+				nrrdNix(m_imageHandle);
+		}
 		
 		m_imageHandle = 0;
 	}
 
+	if (m_mapping)
+	{
+		munmap(m_mapping, m_mappingSize);
+
+		m_mapping = 0;
+		m_mappingSize = 0;
+	}
+
+	m_ownsData = true;
+
+	m_sampler->SetVolume(0);
+
+	m_normalCache.reset();
+
 	m_isOpen = false;
 
 	m_isCopy = false;
@@ -156,6 +272,14 @@ bool CGageAdaptor::IsOpen(void) const
 	return m_isOpen;
 }
 
+/**
+True when the voxels are mapped from the file rather than read into memory.
+*/
+bool CGageAdaptor::IsMapped(void) const
+{
+	return m_mapping != 0;
+}
+
 /**
 */
 bool CGageAdaptor::EnableQuery(int item)
@@ -240,6 +364,8 @@ bool CGageAdaptor::EnableQuery(int item)
 			return false;
 	}
 
+	UpdateAnswer();
+
 	if (!UpdateKernel())
 	{
 		return false;
@@ -260,6 +386,10 @@ bool CGageAdaptor::ResetKernel(void)
 	if (m_measurementContext)
 	{
 		gageKernelReset(m_measurementContext);
+
+		m_sampler->SetKernel(0, 0);
+
+		m_valueKernel = 0;
 		
 		if (!UpdateKernel())
 		{
@@ -301,6 +431,13 @@ bool CGageAdaptor::SetValueKernel(const NrrdKernel *type, const double *paramete
 		return false;
 	}
 
+	// GetValues falls back to gageProbe when the kernel is not supported.
+	m_sampler->SetKernel(type, parameters);
+
+	m_valueKernel = type;
+	memset(m_valueKernelParameters, 0, sizeof(m_valueKernelParameters));
+	memcpy(m_valueKernelParameters, parameters, type->numParm * sizeof(double));
+
 	// cscheid 20081027 With teem 1.10, UpdateKernel does not work
 	// here when context is being initialized, since gage needs the query items which
         // will not have been set
@@ -308,6 +445,18 @@ bool CGageAdaptor::SetValueKernel(const NrrdKernel *type, const double *paramete
 	return true;
 }
 
+/**
+Returns the value kernel and copies its parameters, NRRD_KERNEL_PARMS_NUM of
+them, or null if it is not set.
+*/
+const NrrdKernel *CGageAdaptor::GetValueKernel(double *parameters) const
+{
+	if (m_valueKernel)
+		memcpy(parameters, m_valueKernelParameters, sizeof(m_valueKernelParameters));
+
+	return m_valueKernel;
+}
+
 /**
 */
 bool CGageAdaptor::Set1stDerivativeKernel(const NrrdKernel *type, const double *parameters)
@@ -461,6 +610,20 @@ const GAGE_TYPE *CGageAdaptor::GetValueArray(void) const
 	return (GAGE_TYPE*)m_imageInfo->nin->data;
 }
 
+/**
+Runs the kernels once and returns every enabled answer at (x, y, z). The
+pointers stay valid until the next probe on this adaptor.
+*/
+const CGageAdaptor::ANSWER& CGageAdaptor::Probe(float x, float y, float z) const
+{
+	if (m_doClamp)
+		Clamp(&x, &y, &z);
+
+	gageProbe(m_measurementContext, x, y, z);
+
+	return m_answer;
+}
+
 /**
 */
 GAGE_TYPE CGageAdaptor::GetValue(float x, float y, float z) const
@@ -482,6 +645,36 @@ GAGE_TYPE CGageAdaptor::GetValue(float x, float y, float z) const
     return *m_valuePointer;
 }
 
+/**
+Reconstructs the values at count interleaved x, y, z index space positions.
+*/
+void CGageAdaptor::GetValues(const float *positions, unsigned int count, GAGE_TYPE *values) const
+{
+	if (m_sampler->IsSupported())
+	{
+		m_sampler->Sample(positions, count, values);
+		return;
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+		values[i] = GetValue(positions[3*i + 0], positions[3*i + 1], positions[3*i + 2]);
+}
+
+/**
+Reconstructs the values at the count evenly spaced positions start + i * step.
+*/
+void CGageAdaptor::GetValues(const float *start, const float *step, unsigned int count, GAGE_TYPE *values) const
+{
+	if (m_sampler->IsSupported())
+	{
+		m_sampler->Sample(start, step, count, values);
+		return;
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+		values[i] = GetValue(start[0] + i * step[0], start[1] + i * step[1], start[2] + i * step[2]);
+}
+
 /**
 */
 const GAGE_TYPE *CGageAdaptor::GetNormal(float x, float y, float z) const
@@ -510,6 +703,85 @@ const GAGE_TYPE *CGageAdaptor::GetNormal(void) const
 	return m_normalPointer;
 }
 
+/**
+Chooses the voxel storage read by GetValues; gage keeps probing the Nrrd.
+BRICKED_LAYOUT copies the volume into bricks of brickSize^3 voxels, brickSize
+being a power of two. Clones made afterwards share the bricks.
+*/
+bool CGageAdaptor::SetLayout(LAYOUT layout, unsigned int brickSize)
+{
+	if (m_isCopy || !IsOpen())
+	{
+		return false;
+	}
+
+	return m_sampler->SetLayout(layout, brickSize);
+}
+
+/**
+Memory used by the bricked copy of the volume, in bytes, or 0 for the linear
+layout.
+*/
+size_t CGageAdaptor::GetLayoutSize(void) const
+{
+	return m_sampler->GetLayoutSize();
+}
+
+/**
+Normals at the count positions start + i * step, stored as consecutive x, y, z
+triplets. They are interpolated from the normal cache when it was built and
+probed with gage otherwise.
+*/
+void CGageAdaptor::GetNormals(const float *start, const float *step, unsigned int count, GAGE_TYPE *normals) const
+{
+	if (m_normalCache)
+	{
+		m_normalCache->GetNormals(start, step, count, normals);
+		return;
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const GAGE_TYPE *normal = GetNormal(start[0] + i * step[0], start[1] + i * step[1], start[2] + i * step[2]);
+
+		normals[3*i + 0] = normal[0];
+		normals[3*i + 1] = normal[1];
+		normals[3*i + 2] = normal[2];
+	}
+}
+
+/**
+Computes the normal at every voxel once, in parallel, so that GetNormals only
+has to interpolate them afterwards. Needs the NORMAL query and the derivative
+kernel to be set. Clones made afterwards share the cache.
+*/
+bool CGageAdaptor::BuildNormalCache(unsigned int threads)
+{
+	if (m_isCopy || !IsOpen())
+	{
+		return false;
+	}
+
+	boost::shared_ptr<CNormalCache> cache(new CNormalCache);
+
+	if (!cache->Build(*this, threads))
+	{
+		return false;
+	}
+
+	m_normalCache = cache;
+
+	return true;
+}
+
+/**
+Memory used by the normal cache, in bytes, or 0 if it was not built.
+*/
+size_t CGageAdaptor::GetNormalCacheSize(void) const
+{
+	return m_normalCache ? m_normalCache->GetSize() : 0;
+}
+
 /**
 */
 const GAGE_TYPE *CGageAdaptor::GetGradient(float x, float y, float z) const
@@ -681,23 +953,14 @@ bool CGageAdaptor::OpenNrrdFromMemory(void *data, VALUE_TYPE type, unsigned int
 
 	nrrdStateDisableContent = AIR_TRUE;
 
-	if (nrrdAlloc_va(m_imageHandle, type, 3, width, height, depth))
+	if (nrrdAlloc_va(m_imageHandle, type, 3, (size_t)width, (size_t)height, (size_t)depth))
 	{
 		Close();
 		
 		return false;
 	}
 
-	switch (type) {
-		case nrrdTypeFloat:
-			memcpy(m_imageHandle->data, data, width*height*depth*sizeof(float));
-			break;
-		case nrrdTypeDouble:
-			memcpy(m_imageHandle->data, data, width*height*depth*sizeof(double));
-			break;
-		default:
-			return false;
-	};
+	memcpy(m_imageHandle->data, data, nrrdElementNumber(m_imageHandle)*nrrdElementSize(m_imageHandle));
 
 	// Why do I have to do it? Gage cannot do it automatically?
 	m_imageHandle->axis[0].spacing = 1.0;
@@ -707,6 +970,129 @@ bool CGageAdaptor::OpenNrrdFromMemory(void *data, VALUE_TYPE type, unsigned int
 	return true;
 }
 
+/**
+Reads the header of path and maps its data read-only. Fails, leaving the
+adaptor closed, when the data cannot be used in place.
+*/
+bool CGageAdaptor::MapNrrd(const std::string& path)
+{
+	if (IsOpen())
+	{
+		return false;
+	}
+
+	m_imageHandle = nrrdNew();
+
+	nrrdStateDisableContent = AIR_TRUE;
+
+	// Parses the header and leaves the data file open at the first voxel,
+	// after the line and byte skips.
+	NrrdIoState *nio = nrrdIoStateNew();
+	nio->skipData = AIR_TRUE;
+	nio->keepNrrdDataFileOpen = AIR_TRUE;
+
+	bool status = !nrrdLoad(m_imageHandle, path.c_str(), nio)
+	           && nio->dataFile
+	           && nio->encoding == nrrdEncodingRaw
+	           && (nrrdElementSize(m_imageHandle) == 1 || nio->endian == airMyEndian());
+
+	if (status)
+	{
+		const int fd = fileno(nio->dataFile);
+		const long offset = ftell(nio->dataFile);
+		const size_t bytes = nrrdElementNumber(m_imageHandle)*nrrdElementSize(m_imageHandle);
+		const long page = sysconf(_SC_PAGESIZE);
+		const size_t skip = (size_t)(offset % page);
+		struct stat info;
+
+		status = offset >= 0 && !fstat(fd, &info) && (size_t)info.st_size >= (size_t)offset + bytes;
+		if (status)
+		{
+			// The mapping must start on a page boundary.
+			void *mapping = mmap(0, skip + bytes, PROT_READ, MAP_SHARED, fd, offset - (long)skip);
+			if (mapping != MAP_FAILED)
+			{
+				m_mapping = mapping;
+				m_mappingSize = skip + bytes;
+				m_imageHandle->data = (char *)mapping + skip;
+				m_ownsData = false;
+			}
+			else
+			{
+				status = false;
+			}
+		}
+	}
+
+	// The mapping stays valid after the file is closed.
+	if (nio->dataFile)
+	{
+		fclose(nio->dataFile);
+		nio->dataFile = 0;
+	}
+	nrrdIoStateNix(nio);
+
+	if (!status)
+	{
+		m_imageHandle->data = 0;
+		nrrdNix(m_imageHandle);
+		m_imageHandle = 0;
+
+		return false;
+	}
+
+	return true;
+}
+
+/**
+*/
+bool CGageAdaptor::WrapNrrd(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth)
+{
+	if (IsOpen())
+	{
+		return false;
+	}
+
+	m_imageHandle = nrrdNew();
+
+	nrrdStateDisableContent = AIR_TRUE;
+
+	m_ownsData = false;
+
+	if (nrrdWrap_va(m_imageHandle, data, type, 3, (size_t)width, (size_t)height, (size_t)depth))
+	{
+		Close();
+		
+		return false;
+	}
+
+	m_imageHandle->axis[0].spacing = 1.0;
+	m_imageHandle->axis[1].spacing = 1.0;
+	m_imageHandle->axis[2].spacing = 1.0;
+
+	return true;
+}
+
+/**
+Sets up the gage context and the native sampler once m_imageHandle is loaded.
+*/
+bool CGageAdaptor::OpenContext(void)
+{
+	if (!CreateDefaultContext())
+	{
+		std::cerr << "create default context failed..." << std::endl;
+		return false;
+	}
+
+	m_sampler->SetVolume(m_imageHandle);
+
+	m_isOpen = true;
+
+	m_isCopy = false;
+
+	return true;
+}
+
 /**
 */
 bool CGageAdaptor::CreateDefaultContext(void)
@@ -786,6 +1172,8 @@ bool CGageAdaptor::CreateDefaultContext(void)
 		return false;
 	}
 
+	UpdateAnswer();
+
 	//if (!(m_normalPointer = gageAnswerPointer(m_measurementContext, m_imageInfo, gageSclNormal)))
 	//{
 	//	MarkError();
@@ -843,14 +1231,38 @@ void CGageAdaptor::Clamp(float *x, float *y, float *z) const
 		*z = m_measurementContext->shape->size[2] - 1.0f - FLT_EPSILON;
 }
 
+/**
+*/
+void CGageAdaptor::UpdateAnswer(void)
+{
+	m_answer.value = m_valuePointer;
+	m_answer.normal = m_normalPointer;
+	m_answer.gradient = m_gradientPointer;
+	m_answer.gradientMagnitude = m_gradientMagnitudePointer;
+	m_answer.hessian = m_hessianPointer;
+	m_answer.laplacian = m_laplacianPointer;
+	m_answer.hessian1stEigenvalue = m_hessian1stEigenvaluePointer;
+	m_answer.hessian2ndEigenvalue = m_hessian2ndEigenvaluePointer;
+	m_answer.hessian3rdEigenvalue = m_hessian3rdEigenvaluePointer;
+	m_answer.principalCurvature = m_1stPrincipleCurvaturePointer;
+}
+
 /**
 */
 void CGageAdaptor::Create(void)
 {
 	m_imageHandle = 0;
+	m_ownsData = true;
+	m_mapping = 0;
+	m_mappingSize = 0;
 
 	m_measurementContext = 0;
 	m_imageInfo = 0;
+
+	m_sampler.reset(new CNativeSampler);
+
+	m_valueKernel = 0;
+	memset(m_valueKernelParameters, 0, sizeof(m_valueKernelParameters));
 	
 	m_valuePointer = 0;
 	m_normalPointer = 0;
@@ -868,6 +1280,8 @@ void CGageAdaptor::Create(void)
 
 	m_1stPrincipleCurvaturePointer = 0;
 
+	UpdateAnswer();
+
 	m_isOpen = false;
 
 	m_isCopy = false;
@@ -57,6 +57,8 @@ marching methods. IEEE Trans. Vis Comp. Graph. 2009
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
 
+class CNativeSampler;
+class CNormalCache;
 
 class CGageAdaptor
 	: boost::noncopyable
@@ -104,17 +106,43 @@ public:
 		// 8-byte floating point.
 		DOUBLE = nrrdTypeDouble
 	};
+	// Voxel storage read by GetValues.
+	enum LAYOUT {
+		// The Nrrd itself, x-fastest.
+		LINEAR_LAYOUT,
+		// A copy split in cubic bricks stored in Z-order.
+		BRICKED_LAYOUT
+	};
+	// Answers of the enabled query items after the last probe. Items that
+	// are not enabled are null.
+	struct ANSWER {
+		const GAGE_TYPE *value;
+		const GAGE_TYPE *normal;
+		const GAGE_TYPE *gradient;
+		const GAGE_TYPE *gradientMagnitude;
+		const GAGE_TYPE *hessian;
+		const GAGE_TYPE *laplacian;
+		const GAGE_TYPE *hessian1stEigenvalue;
+		const GAGE_TYPE *hessian2ndEigenvalue;
+		const GAGE_TYPE *hessian3rdEigenvalue;
+		const GAGE_TYPE *principalCurvature;
+	};
 	CGageAdaptor(void);
 	CGageAdaptor(const std::string& path);
 	virtual ~CGageAdaptor(void);
 	virtual bool Open(const std::string& path);
+	virtual bool OpenMapped(const std::string& path);
 	virtual bool OpenFromMemory(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth);
+	virtual bool OpenFromExternalMemory(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth);
+	virtual boost::shared_ptr<CGageAdaptor> Clone(void) const;
 	virtual void Close(void);
 	virtual bool IsOpen(void) const;
+	virtual bool IsMapped(void) const;
 	virtual bool EnableQuery(int item);
 	virtual bool ResetKernel(void);
 	virtual void SetClamp(bool doClamp);
 	virtual bool SetValueKernel(const NrrdKernel *type, const double *parameters);
+	virtual const NrrdKernel *GetValueKernel(double *parameters) const;
 	virtual bool Set1stDerivativeKernel(const NrrdKernel *type, const double *parameters);
 	virtual bool Set2ndDerivativeKernel(const NrrdKernel *type, const double *parameters);
 	virtual int GetWidth(void) const;
@@ -122,9 +150,17 @@ public:
 	virtual int GetDepth(void) const;
 	virtual VALUE_TYPE GetType(void) const;
 	virtual const GAGE_TYPE *GetValueArray(void) const;
+	virtual const ANSWER& Probe(float x, float y, float z) const;
 	virtual GAGE_TYPE GetValue(float x, float y, float z) const;
+	virtual void GetValues(const float *positions, unsigned int count, GAGE_TYPE *values) const;
+	virtual void GetValues(const float *start, const float *step, unsigned int count, GAGE_TYPE *values) const;
+	virtual bool SetLayout(LAYOUT layout, unsigned int brickSize);
+	virtual size_t GetLayoutSize(void) const;
 	virtual const GAGE_TYPE *GetNormal(float x, float y, float z) const;
 	const GAGE_TYPE *GetNormal(void) const;
+	virtual void GetNormals(const float *start, const float *step, unsigned int count, GAGE_TYPE *normals) const;
+	virtual bool BuildNormalCache(unsigned int threads);
+	virtual size_t GetNormalCacheSize(void) const;
 	virtual const GAGE_TYPE *GetGradient(float x, float y, float z) const;
 	virtual GAGE_TYPE GetGradientMagnitude(float x, float y, float z) const;
 	virtual const GAGE_TYPE *GetHessian(float x, float y, float z) const;
@@ -135,16 +171,29 @@ public:
 	virtual GAGE_TYPE Get1stPrincipalCurvature(float x, float y, float z) const;
 private:
 	bool OpenNrrd(const std::string& path);
+	bool MapNrrd(const std::string& path);
 	bool OpenNrrdFromMemory(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth);
+	bool WrapNrrd(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth);
+	bool OpenContext(void);
 	bool CreateDefaultContext(void);
 	bool UpdateKernel(void);
 	inline void Clamp(float *x, float *y, float *z) const;
+	void UpdateAnswer(void);
 protected:
 	void Create(void);
 protected:
 	Nrrd *m_imageHandle;
+	// False when the voxels of m_imageHandle are mapped or borrowed from the
+	// caller, in which case only the Nrrd struct is freed on close.
+	bool m_ownsData;
+	void *m_mapping;
+	size_t m_mappingSize;
 	gageContext *m_measurementContext;
 	gagePerVolume *m_imageInfo;
+	boost::shared_ptr<CNativeSampler> m_sampler;
+	boost::shared_ptr<const CNormalCache> m_normalCache;
+	const NrrdKernel *m_valueKernel;
+	double m_valueKernelParameters[NRRD_KERNEL_PARMS_NUM];
 
 	const GAGE_TYPE *m_valuePointer;
 	const GAGE_TYPE *m_normalPointer;
@@ -156,6 +205,7 @@ protected:
 	const GAGE_TYPE *m_hessian2ndEigenvaluePointer;
 	const GAGE_TYPE *m_hessian3rdEigenvaluePointer;
 	const GAGE_TYPE *m_1stPrincipleCurvaturePointer;
+	ANSWER m_answer;
 	bool m_isOpen;
 	bool m_isCopy;
 	bool m_doClamp;
@@ -0,0 +1,228 @@
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include "MinMaxGrid.h"
+#include "scheduler.h"
+
+namespace {
+
+// Largest sum of the absolute weights of the kernel taps along one axis, over
+// the positions in a voxel. The weights of the 3D reconstruction are products
+// of three of them and sum to one, so it can leave the range of the voxels by
+// at most (sum^3 - 1) / 2 of its width on each side.
+double WeightSum(const NrrdKernel *kernel, const double *parameters, int reach)
+{
+	double sum = 1.0;
+
+	for (unsigned int s = 0; s <= 64; ++s)
+	{
+		const double t = s / 64.0;
+		double w = 0.0;
+		for (int k = -reach; k <= reach; ++k)
+			w += std::fabs(kernel->eval1_d(t - k, parameters));
+		sum = std::max(sum, w);
+	}
+
+	return sum;
+}
+
+// True when the kernel goes through the voxel values, so that probing at
+// the voxel centers gives the voxels themselves.
+bool IsInterpolating(const NrrdKernel *kernel, const double *parameters, int reach)
+{
+	if (std::fabs(kernel->eval1_d(0.0, parameters) - 1.0) > 1e-6)
+		return false;
+
+	for (int k = 1; k <= reach; ++k)
+	{
+		if (std::fabs(kernel->eval1_d(k, parameters)) > 1e-6 ||
+			std::fabs(kernel->eval1_d(-k, parameters)) > 1e-6)
+			return false;
+	}
+
+	return true;
+}
+
+}
+
+/**
+*/
+CMinMaxGrid::CMinMaxGrid(void)
+	: m_cellSize(0)
+{
+	m_cells[0] = m_cells[1] = m_cells[2] = 0;
+}
+
+/**
+Reads the voxels of image directly when it keeps them in memory, and probes
+them at the voxel centers with clones of image otherwise, which needs an
+interpolating value kernel. Cells are built one z-slab at a time on threads
+threads.
+*/
+bool CMinMaxGrid::Build(const CGageAdaptor& image, unsigned int cellSize, unsigned int threads)
+{
+	double parameters[NRRD_KERNEL_PARMS_NUM];
+	const NrrdKernel *kernel = image.GetValueKernel(parameters);
+	const int size[3] = {image.GetWidth(), image.GetHeight(), image.GetDepth()};
+
+	m_min.clear();
+	m_max.clear();
+
+	if (!kernel || !cellSize || !size[0] || !size[1] || !size[2])
+	{
+		std::cerr << "min/max grid needs an open image with a value kernel..." << std::endl;
+		return false;
+	}
+
+	// Voxels farther than reach from a position have no weight.
+	const int reach = std::max(1, (int)std::ceil(kernel->support(parameters)));
+	const double sum = WeightSum(kernel, parameters, reach);
+	const double overshoot = 0.5 * (sum * sum * sum - 1.0);
+
+	const GAGE_TYPE *data = image.GetValueArray();
+	const int type = image.GetType();
+
+	threads = std::max(1u, threads);
+	std::vector< boost::shared_ptr<CGageAdaptor> > clones;
+	if (!data)
+	{
+		if (!IsInterpolating(kernel, parameters, reach))
+		{
+			std::cerr << "min/max grid needs the voxels or an interpolating kernel..." << std::endl;
+			return false;
+		}
+
+		clones.resize(threads);
+		for (unsigned int t = 0; t < threads; ++t)
+		{
+			if (!(clones[t] = image.Clone()))
+			{
+				return false;
+			}
+		}
+	}
+
+	m_cellSize = (int)cellSize;
+	for (unsigned int a = 0; a < 3; ++a)
+		m_cells[a] = std::max(1, (size[a] - 1 + m_cellSize - 1) / m_cellSize);
+
+	m_min.resize(GetCellCount());
+	m_max.resize(GetCellCount());
+
+	const size_t sx = size[0];
+	const size_t sxy = sx * size[1];
+	auto work = [&](unsigned int t, unsigned int k, ThreadStats&)
+	{
+		// Voxels under the support of the positions of the cells of slab k,
+		// bled at the border.
+		int lo[3], hi[3];
+		lo[2] = std::max(0, (int)k * m_cellSize - reach + 1);
+		hi[2] = std::min(size[2] - 1, ((int)k + 1) * m_cellSize + reach - 1);
+
+		std::vector<GAGE_TYPE> row(size[0]);
+		std::vector<float> start(3), step(3, 0.0f);
+		step[0] = 1.0f;
+
+		for (int j = 0; j < m_cells[1]; ++j)
+		{
+			lo[1] = std::max(0, j * m_cellSize - reach + 1);
+			hi[1] = std::min(size[1] - 1, (j + 1) * m_cellSize + reach - 1);
+
+			std::vector<float> cellMin(m_cells[0], HUGE_VALF), cellMax(m_cells[0], -HUGE_VALF);
+
+			for (int z = lo[2]; z <= hi[2]; ++z)
+			{
+				for (int y = lo[1]; y <= hi[1]; ++y)
+				{
+					if (data)
+					{
+						for (int x = 0; x < size[0]; ++x)
+							row[x] = (GAGE_TYPE)nrrdDLookup[type](data, z * sxy + y * sx + x);
+					}
+					else
+					{
+						start[0] = 0.0f;
+						start[1] = (float)y;
+						start[2] = (float)z;
+						clones[t]->GetValues(&start[0], &step[0], size[0], &row[0]);
+					}
+
+					for (int i = 0; i < m_cells[0]; ++i)
+					{
+						lo[0] = std::max(0, i * m_cellSize - reach + 1);
+						hi[0] = std::min(size[0] - 1, (i + 1) * m_cellSize + reach - 1);
+						for (int x = lo[0]; x <= hi[0]; ++x)
+						{
+							cellMin[i] = std::min(cellMin[i], (float)row[x]);
+							cellMax[i] = std::max(cellMax[i], (float)row[x]);
+						}
+					}
+				}
+			}
+
+			for (int i = 0; i < m_cells[0]; ++i)
+			{
+				const float widen = (float)(overshoot * (cellMax[i] - cellMin[i]));
+				const size_t cell = GetCellIndex(i, j, k);
+				m_min[cell] = cellMin[i] - widen;
+				m_max[cell] = cellMax[i] + widen;
+			}
+		}
+	};
+
+	std::vector<ThreadStats> stats;
+	run_tiles(m_cells[2], threads, work, stats);
+
+	return true;
+}
+
+/**
+*/
+int CMinMaxGrid::GetCellSize(void) const
+{
+	return m_cellSize;
+}
+
+/**
+*/
+int CMinMaxGrid::GetCells(unsigned int axis) const
+{
+	return m_cells[axis];
+}
+
+/**
+*/
+size_t CMinMaxGrid::GetCellCount(void) const
+{
+	return (size_t)m_cells[0] * m_cells[1] * m_cells[2];
+}
+
+/**
+*/
+size_t CMinMaxGrid::GetCellIndex(int i, int j, int k) const
+{
+	return ((size_t)k * m_cells[1] + j) * m_cells[0] + i;
+}
+
+/**
+*/
+float CMinMaxGrid::GetMin(size_t cell) const
+{
+	return m_min[cell];
+}
+
+/**
+*/
+float CMinMaxGrid::GetMax(size_t cell) const
+{
+	return m_max[cell];
+}
+
+/**
+Memory used by the grid, in bytes.
+*/
+size_t CMinMaxGrid::GetSize(void) const
+{
+	return (m_min.size() + m_max.size()) * sizeof(float);
+}
@@ -0,0 +1,35 @@
+#ifndef MINMAXGRID_INCLUDED
+#define MINMAXGRID_INCLUDED
+
+#include <vector>
+
+#include "GageAdaptor.h"
+
+/**
+Bounds of the reconstructed scalar field over macro-cells of cellSize^3
+voxels. Cell (i, j, k) covers the index space positions [i, i+1] * cellSize
+(and likewise along y and z), clipped to the volume. Its range covers every
+value the adaptor's value kernel can reconstruct in it: the range of the
+voxels under the kernel's support, widened by the kernel's overshoot.
+*/
+class CMinMaxGrid
+	: boost::noncopyable
+{
+public:
+	CMinMaxGrid(void);
+	bool Build(const CGageAdaptor& image, unsigned int cellSize, unsigned int threads);
+	int GetCellSize(void) const;
+	int GetCells(unsigned int axis) const;
+	size_t GetCellCount(void) const;
+	size_t GetCellIndex(int i, int j, int k) const;
+	float GetMin(size_t cell) const;
+	float GetMax(size_t cell) const;
+	size_t GetSize(void) const;
+protected:
+	int m_cellSize;
+	int m_cells[3];
+	std::vector<float> m_min;
+	std::vector<float> m_max;
+};
+
+#endif // MINMAXGRID_INCLUDED
@@ -0,0 +1,625 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "NativeSampler.h"
+
+#ifdef NATIVE_SAMPLER_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Memory offset of voxel (x, y, z), in voxels, for each storage order.
+struct LinearLayout
+{
+	LinearLayout(const int *size)
+		: sx(size[0]), sxy((size_t)size[0] * size[1])
+	{
+	}
+	inline size_t Index(int x, int y, int z) const
+	{
+		return x + sx * y + sxy * z;
+	}
+#ifdef NATIVE_SAMPLER_AVX2
+	inline __m256i Index(__m256i x, __m256i y, __m256i z) const
+	{
+		const __m256i row = _mm256_mullo_epi32(y, _mm256_set1_epi32((int)sx));
+		const __m256i slice = _mm256_mullo_epi32(z, _mm256_set1_epi32((int)sxy));
+		return _mm256_add_epi32(x, _mm256_add_epi32(row, slice));
+	}
+#endif
+	size_t sx;
+	size_t sxy;
+};
+
+struct BrickedLayout
+{
+	BrickedLayout(int shift, const int *bricks, const uint32_t *slots)
+		: shift(shift), mask((1 << shift) - 1), nbx(bricks[0]), nbxy(bricks[0] * bricks[1]), slots(slots)
+	{
+	}
+	inline size_t Index(int x, int y, int z) const
+	{
+		const size_t brick = slots[(x >> shift) + nbx * (y >> shift) + nbxy * (z >> shift)];
+		return (brick << (3 * shift)) + (x & mask) + ((y & mask) << shift) + ((z & mask) << (2 * shift));
+	}
+#ifdef NATIVE_SAMPLER_AVX2
+	inline __m256i Index(__m256i x, __m256i y, __m256i z) const
+	{
+		const __m128i s1 = _mm_cvtsi32_si128(shift);
+		const __m128i s2 = _mm_cvtsi32_si128(2 * shift);
+		const __m128i s3 = _mm_cvtsi32_si128(3 * shift);
+		const __m256i m = _mm256_set1_epi32(mask);
+
+		__m256i brick = _mm256_srl_epi32(x, s1);
+		brick = _mm256_add_epi32(brick, _mm256_mullo_epi32(_mm256_srl_epi32(y, s1), _mm256_set1_epi32(nbx)));
+		brick = _mm256_add_epi32(brick, _mm256_mullo_epi32(_mm256_srl_epi32(z, s1), _mm256_set1_epi32(nbxy)));
+		const __m256i slot = _mm256_i32gather_epi32((const int*)slots, brick, 4);
+
+		__m256i index = _mm256_sll_epi32(slot, s3);
+		index = _mm256_add_epi32(index, _mm256_and_si256(x, m));
+		index = _mm256_add_epi32(index, _mm256_sll_epi32(_mm256_and_si256(y, m), s1));
+		return _mm256_add_epi32(index, _mm256_sll_epi32(_mm256_and_si256(z, m), s2));
+	}
+#endif
+	int shift;
+	int mask;
+	int nbx;
+	int nbxy;
+	const uint32_t *slots;
+};
+
+// Interleaves the bits of x, y and z, x in the lowest bit.
+inline uint64_t Morton(uint64_t x, uint64_t y, uint64_t z)
+{
+	uint64_t code = 0;
+	for (unsigned int b = 0; b < 21; ++b)
+		code |= (((x >> b) & 1) << (3*b)) | (((y >> b) & 1) << (3*b + 1)) | (((z >> b) & 1) << (3*b + 2));
+	return code;
+}
+
+// Positions are reconstructed in blocks of this many, stored as separate
+// x, y and z arrays.
+const unsigned int BLOCK = 64;
+
+inline float ClampFloat(float v, float lo, float hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+inline int ClampInt(int v, int lo, int hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+}
+
+/**
+*/
+CNativeSampler::CNativeSampler(void)
+	: m_volume(0), m_data(0), m_type(nrrdTypeUnknown), m_kernel(UNSUPPORTED), m_layout(CGageAdaptor::LINEAR_LAYOUT), m_brickShift(0)
+{
+	m_size[0] = m_size[1] = m_size[2] = 0;
+	m_bricks[0] = m_bricks[1] = m_bricks[2] = 0;
+	std::fill(m_a, m_a + 4, 0.0f);
+	std::fill(m_b, m_b + 4, 0.0f);
+}
+
+/**
+*/
+bool CNativeSampler::SetVolume(const Nrrd *nrrd)
+{
+	m_volume = 0;
+	m_data = 0;
+	m_layout = CGageAdaptor::LINEAR_LAYOUT;
+	m_brickSlots.reset();
+	m_bricked.reset();
+
+	if (!nrrd || nrrd->dim != 3 || !nrrd->data)
+	{
+		return false;
+	}
+
+	switch (nrrd->type) {
+		case nrrdTypeChar:
+		case nrrdTypeUChar:
+		case nrrdTypeShort:
+		case nrrdTypeUShort:
+		case nrrdTypeInt:
+		case nrrdTypeUInt:
+		case nrrdTypeFloat:
+		case nrrdTypeDouble:
+			break;
+		default:
+			return false;
+	}
+
+	m_volume = nrrd->data;
+	m_data = m_volume;
+	m_type = nrrd->type;
+	for (unsigned int i = 0; i < 3; ++i)
+		m_size[i] = (int)nrrd->axis[i].size;
+
+	return true;
+}
+
+/**
+Chooses where the voxels are read from. BRICKED_LAYOUT makes a bricked copy
+of the volume; brickSize must be a power of two.
+*/
+bool CNativeSampler::SetLayout(CGageAdaptor::LAYOUT layout, unsigned int brickSize)
+{
+	if (!m_volume)
+	{
+		return false;
+	}
+
+	m_layout = CGageAdaptor::LINEAR_LAYOUT;
+	m_data = m_volume;
+	m_brickSlots.reset();
+	m_bricked.reset();
+
+	if (layout == CGageAdaptor::LINEAR_LAYOUT)
+	{
+		return true;
+	}
+
+	if (brickSize < 2 || brickSize > 256 || (brickSize & (brickSize - 1)))
+	{
+		return false;
+	}
+
+	m_brickShift = 0;
+	while ((1u << m_brickShift) < brickSize)
+		++m_brickShift;
+
+	for (unsigned int a = 0; a < 3; ++a)
+		m_bricks[a] = (m_size[a] + brickSize - 1) >> m_brickShift;
+
+	const size_t count = (size_t)m_bricks[0] * m_bricks[1] * m_bricks[2];
+
+	// Storage slots follow the Z-order of the brick coordinates, skipping
+	// the codes that fall outside the brick grid.
+	std::vector< std::pair<uint64_t, uint32_t> > order(count);
+	for (int bz = 0, b = 0; bz < m_bricks[2]; ++bz)
+		for (int by = 0; by < m_bricks[1]; ++by)
+			for (int bx = 0; bx < m_bricks[0]; ++bx, ++b)
+				order[b] = std::make_pair(Morton(bx, by, bz), (uint32_t)b);
+	std::sort(order.begin(), order.end());
+
+	boost::shared_ptr< std::vector<uint32_t> > slots(new std::vector<uint32_t>(count));
+	for (size_t slot = 0; slot < count; ++slot)
+		(*slots)[order[slot].second] = (uint32_t)slot;
+
+	const size_t element = nrrdTypeSize[m_type];
+	const size_t brickVoxels = (size_t)1 << (3 * m_brickShift);
+	boost::shared_ptr< std::vector<unsigned char> > bricked(new std::vector<unsigned char>(count * brickVoxels * element));
+
+	const unsigned char *src = (const unsigned char*)m_volume;
+	unsigned char *dst = &(*bricked)[0];
+	const size_t sx = m_size[0];
+	const size_t sxy = sx * m_size[1];
+	for (int bz = 0, b = 0; bz < m_bricks[2]; ++bz)
+	{
+		for (int by = 0; by < m_bricks[1]; ++by)
+		{
+			for (int bx = 0; bx < m_bricks[0]; ++bx, ++b)
+			{
+				unsigned char *brick = dst + (*slots)[b] * brickVoxels * element;
+
+				// Voxels past the border are never read, they are bled
+				// from the border just to keep the bricks initialized.
+				for (int lz = 0; lz < (int)brickSize; ++lz)
+				{
+					const size_t z = std::min((bz << m_brickShift) + lz, m_size[2] - 1);
+					for (int ly = 0; ly < (int)brickSize; ++ly)
+					{
+						const size_t y = std::min((by << m_brickShift) + ly, m_size[1] - 1);
+						for (int lx = 0; lx < (int)brickSize; ++lx)
+						{
+							const size_t x = std::min((bx << m_brickShift) + lx, m_size[0] - 1);
+							memcpy(brick + ((lz * brickSize + ly) * brickSize + lx) * element,
+							       src + (z * sxy + y * sx + x) * element, element);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	m_brickSlots = slots;
+	m_bricked = bricked;
+	m_data = &(*m_bricked)[0];
+	m_layout = CGageAdaptor::BRICKED_LAYOUT;
+
+	return true;
+}
+
+/**
+*/
+CGageAdaptor::LAYOUT CNativeSampler::GetLayout(void) const
+{
+	return m_layout;
+}
+
+/**
+Memory used by the bricked copy of the volume, in bytes.
+*/
+size_t CNativeSampler::GetLayoutSize(void) const
+{
+	return m_bricked ? m_bricked->size() + m_brickSlots->size() * sizeof(uint32_t) : 0;
+}
+
+/**
+Returns false if the kernel cannot be reconstructed natively; Sample must not
+be called in that case.
+*/
+bool CNativeSampler::SetKernel(const NrrdKernel *type, const double *parameters)
+{
+	m_kernel = UNSUPPORTED;
+
+	if (!type || !parameters || parameters[0] != 1.0)
+	{
+		return false;
+	}
+
+	if (type == nrrdKernelTent)
+	{
+		m_kernel = TENT;
+	}
+	else if (type == nrrdKernelBCCubic)
+	{
+		const float B = (float)parameters[1];
+		const float C = (float)parameters[2];
+
+		m_a[0] = (12.0f - 9.0f*B - 6.0f*C) / 6.0f;
+		m_a[1] = (-18.0f + 12.0f*B + 6.0f*C) / 6.0f;
+		m_a[2] = 0.0f;
+		m_a[3] = (6.0f - 2.0f*B) / 6.0f;
+
+		m_b[0] = (-B - 6.0f*C) / 6.0f;
+		m_b[1] = (6.0f*B + 30.0f*C) / 6.0f;
+		m_b[2] = (-12.0f*B - 48.0f*C) / 6.0f;
+		m_b[3] = (8.0f*B + 24.0f*C) / 6.0f;
+
+		m_kernel = BC_CUBIC;
+	}
+
+	return m_kernel != UNSUPPORTED;
+}
+
+/**
+*/
+bool CNativeSampler::IsSupported(void) const
+{
+	return m_data && m_kernel != UNSUPPORTED;
+}
+
+/**
+positions holds count interleaved x, y, z triplets in index space.
+*/
+void CNativeSampler::Sample(const float *positions, unsigned int count, GAGE_TYPE *values) const
+{
+	float x[BLOCK], y[BLOCK], z[BLOCK];
+
+	for (unsigned int first = 0; first < count; first += BLOCK)
+	{
+		const unsigned int n = std::min(BLOCK, count - first);
+		const float *p = positions + 3 * first;
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			x[i] = p[3*i + 0];
+			y[i] = p[3*i + 1];
+			z[i] = p[3*i + 2];
+		}
+
+		Reconstruct(x, y, z, n, values + first);
+	}
+}
+
+/**
+Samples the count positions start + i * step, i = 0, ..., count-1.
+*/
+void CNativeSampler::Sample(const float *start, const float *step, unsigned int count, GAGE_TYPE *values) const
+{
+	float x[BLOCK], y[BLOCK], z[BLOCK];
+
+	for (unsigned int first = 0; first < count; first += BLOCK)
+	{
+		const unsigned int n = std::min(BLOCK, count - first);
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			const float k = (float)(first + i);
+			x[i] = start[0] + k * step[0];
+			y[i] = start[1] + k * step[1];
+			z[i] = start[2] + k * step[2];
+		}
+
+		Reconstruct(x, y, z, n, values + first);
+	}
+}
+
+/**
+*/
+void CNativeSampler::Reconstruct(const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const
+{
+	if (m_layout == CGageAdaptor::BRICKED_LAYOUT)
+		Reconstruct(BrickedLayout(m_brickShift, m_bricks, &(*m_brickSlots)[0]), x, y, z, count, values);
+	else
+		Reconstruct(LinearLayout(m_size), x, y, z, count, values);
+}
+
+/**
+*/
+template<typename Layout>
+void CNativeSampler::Reconstruct(const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const
+{
+#ifdef NATIVE_SAMPLER_AVX2
+	// Gathers take 32 bit signed offsets.
+	const double voxels = m_bricked
+		? (double)m_bricked->size() / sizeof(float)
+		: (double)m_size[0] * m_size[1] * m_size[2];
+
+	if (m_type == nrrdTypeFloat && voxels < 2147483647.0)
+	{
+		const float *data = (const float*)m_data;
+		const unsigned int done = m_kernel == TENT
+			? TrilinearAVX2(data, layout, x, y, z, count, values)
+			: CubicAVX2(data, layout, x, y, z, count, values);
+
+		x += done; y += done; z += done; values += done;
+		count -= done;
+	}
+#endif
+
+#define NATIVE_SAMPLER_CASE(TYPE, VOXEL) \
+		case TYPE: \
+			if (m_kernel == TENT) \
+				Trilinear((const VOXEL*)m_data, layout, x, y, z, count, values); \
+			else \
+				Cubic((const VOXEL*)m_data, layout, x, y, z, count, values); \
+			break;
+
+	switch (m_type) {
+		NATIVE_SAMPLER_CASE(nrrdTypeChar, signed char)
+		NATIVE_SAMPLER_CASE(nrrdTypeUChar, unsigned char)
+		NATIVE_SAMPLER_CASE(nrrdTypeShort, short)
+		NATIVE_SAMPLER_CASE(nrrdTypeUShort, unsigned short)
+		NATIVE_SAMPLER_CASE(nrrdTypeInt, int)
+		NATIVE_SAMPLER_CASE(nrrdTypeUInt, unsigned int)
+		NATIVE_SAMPLER_CASE(nrrdTypeFloat, float)
+		NATIVE_SAMPLER_CASE(nrrdTypeDouble, double)
+	}
+
+#undef NATIVE_SAMPLER_CASE
+}
+
+/**
+*/
+template<typename Voxel, typename Layout>
+void CNativeSampler::Trilinear(const Voxel *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const float px = ClampFloat(x[i], 0.0f, m_size[0] - 1.0f);
+		const float py = ClampFloat(y[i], 0.0f, m_size[1] - 1.0f);
+		const float pz = ClampFloat(z[i], 0.0f, m_size[2] - 1.0f);
+
+		const int x0 = (int)px, y0 = (int)py, z0 = (int)pz;
+		const int x1 = std::min(x0 + 1, m_size[0] - 1);
+		const int y1 = std::min(y0 + 1, m_size[1] - 1);
+		const int z1 = std::min(z0 + 1, m_size[2] - 1);
+		const float tx = px - x0, ty = py - y0, tz = pz - z0;
+
+		const float v000 = data[layout.Index(x0, y0, z0)], v100 = data[layout.Index(x1, y0, z0)];
+		const float v010 = data[layout.Index(x0, y1, z0)], v110 = data[layout.Index(x1, y1, z0)];
+		const float v001 = data[layout.Index(x0, y0, z1)], v101 = data[layout.Index(x1, y0, z1)];
+		const float v011 = data[layout.Index(x0, y1, z1)], v111 = data[layout.Index(x1, y1, z1)];
+
+		const float c00 = v000 + tx * (v100 - v000);
+		const float c10 = v010 + tx * (v110 - v010);
+		const float c01 = v001 + tx * (v101 - v001);
+		const float c11 = v011 + tx * (v111 - v011);
+
+		const float c0 = c00 + ty * (c10 - c00);
+		const float c1 = c01 + ty * (c11 - c01);
+
+		values[i] = c0 + tz * (c1 - c0);
+	}
+}
+
+/**
+Weights of the four taps floor(p)-1, ..., floor(p)+2 for t = p - floor(p).
+*/
+void CNativeSampler::CubicWeights(float t, float *w) const
+{
+	const float d[4] = {1.0f + t, t, 1.0f - t, 2.0f - t};
+	const float *c[4] = {m_b, m_a, m_a, m_b};
+
+	for (unsigned int k = 0; k < 4; ++k)
+		w[k] = ((c[k][0] * d[k] + c[k][1]) * d[k] + c[k][2]) * d[k] + c[k][3];
+}
+
+/**
+*/
+template<typename Voxel, typename Layout>
+void CNativeSampler::Cubic(const Voxel *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const float p[3] = {
+			ClampFloat(x[i], 0.0f, m_size[0] - 1.0f),
+			ClampFloat(y[i], 0.0f, m_size[1] - 1.0f),
+			ClampFloat(z[i], 0.0f, m_size[2] - 1.0f)};
+
+		int tap[3][4];
+		float w[3][4];
+		for (unsigned int a = 0; a < 3; ++a)
+		{
+			const int base = (int)p[a];
+			CubicWeights(p[a] - base, w[a]);
+			for (int k = 0; k < 4; ++k)
+				tap[a][k] = ClampInt(base - 1 + k, 0, m_size[a] - 1);
+		}
+
+		float v = 0.0f;
+		for (unsigned int kz = 0; kz < 4; ++kz)
+		{
+			float vy = 0.0f;
+			for (unsigned int ky = 0; ky < 4; ++ky)
+			{
+				float vx = 0.0f;
+				for (unsigned int kx = 0; kx < 4; ++kx)
+					vx += w[0][kx] * data[layout.Index(tap[0][kx], tap[1][ky], tap[2][kz])];
+				vy += w[1][ky] * vx;
+			}
+			v += w[2][kz] * vy;
+		}
+
+		values[i] = v;
+	}
+}
+
+#ifdef NATIVE_SAMPLER_AVX2
+
+namespace {
+
+inline void Store(GAGE_TYPE *values, __m256 v)
+{
+	float tmp[8];
+	_mm256_storeu_ps(tmp, v);
+	for (unsigned int k = 0; k < 8; ++k)
+		values[k] = tmp[k];
+}
+
+// Horner evaluation of c[0] d^3 + c[1] d^2 + c[2] d + c[3].
+inline __m256 Cubic(const float *c, __m256 d)
+{
+	__m256 r = _mm256_set1_ps(c[0]);
+	r = _mm256_fmadd_ps(r, d, _mm256_set1_ps(c[1]));
+	r = _mm256_fmadd_ps(r, d, _mm256_set1_ps(c[2]));
+	return _mm256_fmadd_ps(r, d, _mm256_set1_ps(c[3]));
+}
+
+}
+
+/**
+Returns how many positions were reconstructed, a multiple of 8. The remaining
+ones are left for the scalar path.
+*/
+template<typename Layout>
+unsigned int CNativeSampler::TrilinearAVX2(const float *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 hi[3] = {
+		_mm256_set1_ps(m_size[0] - 1.0f),
+		_mm256_set1_ps(m_size[1] - 1.0f),
+		_mm256_set1_ps(m_size[2] - 1.0f)};
+	const __m256i last[3] = {
+		_mm256_set1_epi32(m_size[0] - 1),
+		_mm256_set1_epi32(m_size[1] - 1),
+		_mm256_set1_epi32(m_size[2] - 1)};
+	const __m256i one = _mm256_set1_epi32(1);
+
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const float *p[3] = {x + i, y + i, z + i};
+		__m256 t[3];
+		__m256i i0[3], i1[3];
+		for (unsigned int a = 0; a < 3; ++a)
+		{
+			const __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(p[a]), zero), hi[a]);
+			const __m256 f = _mm256_floor_ps(v);
+			t[a] = _mm256_sub_ps(v, f);
+			i0[a] = _mm256_cvttps_epi32(f);
+			i1[a] = _mm256_min_epi32(_mm256_add_epi32(i0[a], one), last[a]);
+		}
+
+		__m256 c[2][2];
+		for (unsigned int kz = 0; kz < 2; ++kz)
+		{
+			for (unsigned int ky = 0; ky < 2; ++ky)
+			{
+				const __m256i yy = ky ? i1[1] : i0[1];
+				const __m256i zz = kz ? i1[2] : i0[2];
+				const __m256 a = _mm256_i32gather_ps(data, layout.Index(i0[0], yy, zz), 4);
+				const __m256 b = _mm256_i32gather_ps(data, layout.Index(i1[0], yy, zz), 4);
+				c[kz][ky] = _mm256_fmadd_ps(t[0], _mm256_sub_ps(b, a), a);
+			}
+		}
+
+		const __m256 c0 = _mm256_fmadd_ps(t[1], _mm256_sub_ps(c[0][1], c[0][0]), c[0][0]);
+		const __m256 c1 = _mm256_fmadd_ps(t[1], _mm256_sub_ps(c[1][1], c[1][0]), c[1][0]);
+
+		Store(values + i, _mm256_fmadd_ps(t[2], _mm256_sub_ps(c1, c0), c0));
+	}
+
+	return i;
+}
+
+/**
+Returns how many positions were reconstructed, a multiple of 8. The remaining
+ones are left for the scalar path.
+*/
+template<typename Layout>
+unsigned int CNativeSampler::CubicAVX2(const float *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256i izero = _mm256_setzero_si256();
+
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const float *p[3] = {x + i, y + i, z + i};
+		__m256 w[3][4];
+		__m256i tap[3][4];
+		for (unsigned int a = 0; a < 3; ++a)
+		{
+			const __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(p[a]), zero), _mm256_set1_ps(m_size[a] - 1.0f));
+			const __m256 f = _mm256_floor_ps(v);
+			const __m256 t = _mm256_sub_ps(v, f);
+			const __m256i base = _mm256_cvttps_epi32(f);
+			const __m256i last = _mm256_set1_epi32(m_size[a] - 1);
+
+			w[a][0] = ::Cubic(m_b, _mm256_add_ps(one, t));
+			w[a][1] = ::Cubic(m_a, t);
+			w[a][2] = ::Cubic(m_a, _mm256_sub_ps(one, t));
+			w[a][3] = ::Cubic(m_b, _mm256_sub_ps(two, t));
+
+			for (int k = 0; k < 4; ++k)
+			{
+				const __m256i index = _mm256_add_epi32(base, _mm256_set1_epi32(k - 1));
+				tap[a][k] = _mm256_min_epi32(_mm256_max_epi32(index, izero), last);
+			}
+		}
+
+		__m256 v = zero;
+		for (unsigned int kz = 0; kz < 4; ++kz)
+		{
+			__m256 vy = zero;
+			for (unsigned int ky = 0; ky < 4; ++ky)
+			{
+				__m256 vx = zero;
+				for (unsigned int kx = 0; kx < 4; ++kx)
+				{
+					const __m256i index = layout.Index(tap[0][kx], tap[1][ky], tap[2][kz]);
+					vx = _mm256_fmadd_ps(w[0][kx], _mm256_i32gather_ps(data, index, 4), vx);
+				}
+				vy = _mm256_fmadd_ps(w[1][ky], vx, vy);
+			}
+			v = _mm256_fmadd_ps(w[2][kz], vy, v);
+		}
+
+		Store(values + i, v);
+	}
+
+	return i;
+}
+
+#endif // NATIVE_SAMPLER_AVX2
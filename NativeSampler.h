@@ -0,0 +1,80 @@
+#ifndef NATIVESAMPLER_INCLUDED
+#define NATIVESAMPLER_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+
+#include <teem/nrrd.h>
+
+#include "GageAdaptor.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#define NATIVE_SAMPLER_AVX2
+#endif
+
+/**
+Reconstructs a scalar Nrrd at many index space positions at once, without
+going through gage. Only the value kernels whose weights we can evaluate
+directly are supported: the tent (trilinear) and the BC cubic family, both
+at unit scale. Voxels outside the volume are bled from the border, as gage
+does. When compiled with AVX2 the float volumes are reconstructed eight
+positions at a time.
+
+The voxels are read either from the Nrrd itself (LINEAR_LAYOUT) or from a
+bricked copy (BRICKED_LAYOUT): cubic bricks of a power of two size, stored
+one after the other in Z-order of the brick coordinates, with the voxels of
+each brick in x-fastest order. The bricked copy is shared by the copies of
+the sampler.
+*/
+class CNativeSampler
+{
+public:
+	enum KERNEL {
+		UNSUPPORTED,
+		TENT,
+		BC_CUBIC
+	};
+	CNativeSampler(void);
+	bool SetVolume(const Nrrd *nrrd);
+	bool SetKernel(const NrrdKernel *type, const double *parameters);
+	bool SetLayout(CGageAdaptor::LAYOUT layout, unsigned int brickSize);
+	CGageAdaptor::LAYOUT GetLayout(void) const;
+	size_t GetLayoutSize(void) const;
+	bool IsSupported(void) const;
+	void Sample(const float *positions, unsigned int count, GAGE_TYPE *values) const;
+	void Sample(const float *start, const float *step, unsigned int count, GAGE_TYPE *values) const;
+private:
+	void Reconstruct(const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const;
+	template<typename Layout>
+	void Reconstruct(const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const;
+	template<typename Voxel, typename Layout>
+	void Trilinear(const Voxel *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const;
+	template<typename Voxel, typename Layout>
+	void Cubic(const Voxel *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const;
+#ifdef NATIVE_SAMPLER_AVX2
+	template<typename Layout>
+	unsigned int TrilinearAVX2(const float *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const;
+	template<typename Layout>
+	unsigned int CubicAVX2(const float *data, const Layout& layout, const float *x, const float *y, const float *z, unsigned int count, GAGE_TYPE *values) const;
+#endif
+	inline void CubicWeights(float t, float *w) const;
+protected:
+	const void *m_volume;
+	const void *m_data;
+	int m_type;
+	int m_size[3];
+	KERNEL m_kernel;
+	// Polynomial coefficients of the BC cubic for |x| < 1 (m_a) and
+	// 1 <= |x| < 2 (m_b), highest degree first.
+	float m_a[4];
+	float m_b[4];
+	CGageAdaptor::LAYOUT m_layout;
+	// log2 of the brick size and number of bricks along each axis.
+	int m_brickShift;
+	int m_bricks[3];
+	// Storage slot of each brick, indexed x-fastest by brick coordinates.
+	boost::shared_ptr< std::vector<uint32_t> > m_brickSlots;
+	boost::shared_ptr< std::vector<unsigned char> > m_bricked;
+};
+
+#endif // NATIVESAMPLER_INCLUDED
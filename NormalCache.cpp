@@ -0,0 +1,193 @@
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include "NormalCache.h"
+#include "scheduler.h"
+
+namespace {
+
+inline float SignNotZero(float v)
+{
+	return v < 0.0f ? -1.0f : 1.0f;
+}
+
+inline uint8_t Quantize(float v)
+{
+	return (uint8_t)std::floor((v * 0.5f + 0.5f) * 255.0f + 0.5f);
+}
+
+// Code 0 would decode to the (-1, -1) corner of the octahedron, that is
+// (0, 0, -1). That direction is also encoded by the (1, 1) corner, so 0 is
+// free to mark voxels without a gradient.
+const uint16_t NO_NORMAL = 0;
+
+}
+
+/**
+*/
+CNormalCache::CNormalCache(void)
+{
+	m_size[0] = m_size[1] = m_size[2] = 0;
+}
+
+/**
+Probes the normal at every voxel center. Each thread works on its own clone of
+image, which must have the NORMAL query enabled.
+*/
+bool CNormalCache::Build(const CGageAdaptor& image, unsigned int threads)
+{
+	m_size[0] = image.GetWidth();
+	m_size[1] = image.GetHeight();
+	m_size[2] = image.GetDepth();
+
+	threads = std::max(1u, threads);
+	std::vector< boost::shared_ptr<CGageAdaptor> > clones(threads);
+	for (unsigned int t = 0; t < threads; ++t)
+	{
+		if (!(clones[t] = image.Clone()) || !clones[t]->Probe(0.0f, 0.0f, 0.0f).normal)
+		{
+			std::cerr << "normal cache needs an open image with the NORMAL query..." << std::endl;
+			m_codes.clear();
+			return false;
+		}
+	}
+
+	m_codes.resize((size_t)m_size[0] * m_size[1] * m_size[2]);
+
+	const size_t sx = m_size[0];
+	const size_t sxy = sx * m_size[1];
+	auto work = [&](unsigned int t, unsigned int z, ThreadStats&)
+	{
+		const CGageAdaptor& clone = *clones[t];
+		for (int y = 0; y < m_size[1]; ++y)
+		{
+			for (int x = 0; x < m_size[0]; ++x)
+			{
+				const CGageAdaptor::ANSWER& answer = clone.Probe((float)x, (float)y, (float)z);
+				m_codes[z * sxy + y * sx + x] = Encode(answer.normal);
+			}
+		}
+	};
+
+	std::vector<ThreadStats> stats;
+	run_tiles(m_size[2], threads, work, stats);
+
+	return true;
+}
+
+/**
+*/
+void CNormalCache::GetNormal(float x, float y, float z, GAGE_TYPE *normal) const
+{
+	const float zero[3] = {0.0f, 0.0f, 0.0f};
+	const float start[3] = {x, y, z};
+
+	GetNormals(start, zero, 1, normal);
+}
+
+/**
+Interpolates the normals at the count positions start + i * step, stored as
+consecutive x, y, z triplets.
+*/
+void CNormalCache::GetNormals(const float *start, const float *step, unsigned int count, GAGE_TYPE *normals) const
+{
+	const size_t sx = m_size[0];
+	const size_t sxy = sx * m_size[1];
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		float p[3];
+		int p0[3], p1[3];
+		for (unsigned int a = 0; a < 3; ++a)
+		{
+			p[a] = std::min(std::max(start[a] + i * step[a], 0.0f), m_size[a] - 1.0f);
+			p0[a] = (int)p[a];
+			p1[a] = std::min(p0[a] + 1, m_size[a] - 1);
+			p[a] -= p0[a];
+		}
+
+		float n[3] = {0.0f, 0.0f, 0.0f};
+		for (unsigned int k = 0; k < 8; ++k)
+		{
+			const int x = k & 1 ? p1[0] : p0[0];
+			const int y = k & 2 ? p1[1] : p0[1];
+			const int z = k & 4 ? p1[2] : p0[2];
+			const float w = (k & 1 ? p[0] : 1.0f - p[0])
+			              * (k & 2 ? p[1] : 1.0f - p[1])
+			              * (k & 4 ? p[2] : 1.0f - p[2]);
+
+			float corner[3];
+			Decode(m_codes[z * sxy + y * sx + x], corner);
+			n[0] += w * corner[0];
+			n[1] += w * corner[1];
+			n[2] += w * corner[2];
+		}
+
+		const float length = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+		const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		normals[3*i + 0] = n[0] * scale;
+		normals[3*i + 1] = n[1] * scale;
+		normals[3*i + 2] = n[2] * scale;
+	}
+}
+
+/**
+Memory used by the cache, in bytes.
+*/
+size_t CNormalCache::GetSize(void) const
+{
+	return m_codes.size() * sizeof(uint16_t);
+}
+
+/**
+*/
+uint16_t CNormalCache::Encode(const GAGE_TYPE *normal)
+{
+	const float l1 = (float)(std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]));
+	if (!(l1 > 0.0f))
+	{
+		return NO_NORMAL;
+	}
+
+	float u = (float)normal[0] / l1;
+	float v = (float)normal[1] / l1;
+	if (normal[2] < 0.0)
+	{
+		const float fu = (1.0f - std::fabs(v)) * SignNotZero(u);
+		const float fv = (1.0f - std::fabs(u)) * SignNotZero(v);
+		u = fu;
+		v = fv;
+	}
+
+	const uint16_t code = (uint16_t)(Quantize(u) | (Quantize(v) << 8));
+
+	return code == NO_NORMAL ? 0xffff : code;
+}
+
+/**
+*/
+void CNormalCache::Decode(uint16_t code, float *normal)
+{
+	if (code == NO_NORMAL)
+	{
+		normal[0] = normal[1] = normal[2] = 0.0f;
+		return;
+	}
+
+	float u = (code & 0xff) / 255.0f * 2.0f - 1.0f;
+	float v = (code >> 8) / 255.0f * 2.0f - 1.0f;
+	const float w = 1.0f - std::fabs(u) - std::fabs(v);
+	if (w < 0.0f)
+	{
+		const float fu = (1.0f - std::fabs(v)) * SignNotZero(u);
+		const float fv = (1.0f - std::fabs(u)) * SignNotZero(v);
+		u = fu;
+		v = fv;
+	}
+
+	const float scale = 1.0f / std::sqrt(u*u + v*v + w*w);
+	normal[0] = u * scale;
+	normal[1] = v * scale;
+	normal[2] = w * scale;
+}
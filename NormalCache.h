@@ -0,0 +1,32 @@
+#ifndef NORMALCACHE_INCLUDED
+#define NORMALCACHE_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+
+#include "GageAdaptor.h"
+
+/**
+Normals of a scalar volume computed once per voxel with the adaptor's
+derivative kernel and stored with a 16 bit octahedral encoding (8 bits per
+coordinate). Normals at arbitrary positions are the trilinear interpolation
+of the decoded voxel normals, renormalized. Voxels where the gradient
+vanishes decode to the zero vector.
+*/
+class CNormalCache
+	: boost::noncopyable
+{
+public:
+	CNormalCache(void);
+	bool Build(const CGageAdaptor& image, unsigned int threads);
+	void GetNormal(float x, float y, float z, GAGE_TYPE *normal) const;
+	void GetNormals(const float *start, const float *step, unsigned int count, GAGE_TYPE *normals) const;
+	size_t GetSize(void) const;
+	static uint16_t Encode(const GAGE_TYPE *normal);
+	static void Decode(uint16_t code, float *normal);
+protected:
+	std::vector<uint16_t> m_codes;
+	int m_size[3];
+};
+
+#endif // NORMALCACHE_INCLUDED
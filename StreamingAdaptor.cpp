@@ -0,0 +1,620 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include "StreamingAdaptor.h"
+#include "NativeSampler.h"
+
+namespace {
+
+const unsigned int NO_BRICK = ~0u;
+
+// Items answered by the streaming adaptor, in the order of m_query.
+enum {
+	QUERY_VALUE,
+	QUERY_GRADIENT,
+	QUERY_GRADIENT_MAGNITUDE,
+	QUERY_NORMAL
+};
+
+// Bricks prefetched past the end of a batch of positions along a ray.
+const float LOOKAHEAD_BRICKS = 2.0f;
+
+}
+
+/**
+*/
+CStreamingAdaptor::CStreamingAdaptor(void)
+	: m_brickIndex(NO_BRICK), m_native(false)
+{
+	m_brickNrrd = nrrdNew();
+
+	m_kernel[0] = m_kernel[1] = 0;
+	memset(m_parameters, 0, sizeof(m_parameters));
+	m_query[QUERY_VALUE] = true;
+	m_query[QUERY_GRADIENT] = m_query[QUERY_GRADIENT_MAGNITUDE] = m_query[QUERY_NORMAL] = false;
+
+	m_value = 0;
+	m_gradient[0] = m_gradient[1] = m_gradient[2] = 0;
+	m_gradientMagnitude = 0;
+	m_normal[0] = m_normal[1] = m_normal[2] = 0;
+}
+
+/**
+*/
+CStreamingAdaptor::~CStreamingAdaptor(void)
+{
+	if (IsOpen())
+		Close();
+
+	nrrdNix(m_brickNrrd);
+}
+
+/**
+Opens a brick file with the default cache size.
+*/
+bool CStreamingAdaptor::Open(const std::string& path)
+{
+	return Open(path, DEFAULT_CACHE_SIZE);
+}
+
+/**
+Opens a brick file, keeping at most cacheSize bytes of bricks in memory. The
+value kernel is reset to the tent, the derivative kernel is unset and only the
+VALUE query is enabled, as for a newly opened CGageAdaptor.
+*/
+bool CStreamingAdaptor::Open(const std::string& path, size_t cacheSize)
+{
+	if (IsOpen())
+		Close();
+
+	m_cache.reset(new CBrickCache);
+
+	if (!m_cache->Open(path, cacheSize))
+	{
+		m_cache.reset();
+		return false;
+	}
+
+	m_isOpen = true;
+
+	m_isCopy = false;
+
+	ResetKernel();
+
+	m_query[QUERY_VALUE] = true;
+	m_query[QUERY_GRADIENT] = m_query[QUERY_GRADIENT_MAGNITUDE] = m_query[QUERY_NORMAL] = false;
+
+	UpdatePointers();
+
+	return true;
+}
+
+/**
+*/
+bool CStreamingAdaptor::OpenMapped(const std::string&)
+{
+	std::cerr << "the streaming adaptor only opens brick files..." << std::endl;
+	return false;
+}
+
+/**
+*/
+bool CStreamingAdaptor::OpenFromMemory(void *, VALUE_TYPE, unsigned int, unsigned int, unsigned int)
+{
+	std::cerr << "the streaming adaptor only opens brick files..." << std::endl;
+	return false;
+}
+
+/**
+*/
+bool CStreamingAdaptor::OpenFromExternalMemory(void *, VALUE_TYPE, unsigned int, unsigned int, unsigned int)
+{
+	std::cerr << "the streaming adaptor only opens brick files..." << std::endl;
+	return false;
+}
+
+/**
+Returns an adaptor sharing the brick cache, with its own pinned brick and
+answer buffers. Kernels and queries must be set before cloning.
+*/
+boost::shared_ptr<CGageAdaptor> CStreamingAdaptor::Clone(void) const
+{
+	boost::shared_ptr<CStreamingAdaptor> copy;
+
+	if (!IsOpen())
+	{
+		return copy;
+	}
+
+	copy.reset(new CStreamingAdaptor);
+
+	copy->m_cache = m_cache;
+	copy->m_isOpen = true;
+	copy->m_isCopy = true;
+	copy->m_doClamp = m_doClamp;
+	copy->m_sampler.reset(new CNativeSampler(*m_sampler));
+	copy->m_normalCache = m_normalCache;
+
+	memcpy(copy->m_kernel, m_kernel, sizeof(m_kernel));
+	memcpy(copy->m_parameters, m_parameters, sizeof(m_parameters));
+	memcpy(copy->m_query, m_query, sizeof(m_query));
+	copy->m_native = m_native;
+
+	copy->UpdatePointers();
+
+	return copy;
+}
+
+/**
+The cache is closed once the last clone sharing it is closed.
+*/
+void CStreamingAdaptor::Close(void)
+{
+	m_brick.reset();
+	m_brickIndex = NO_BRICK;
+
+	m_cache.reset();
+
+	m_sampler->SetVolume(0);
+
+	m_normalCache.reset();
+
+	m_isOpen = false;
+
+	m_isCopy = false;
+}
+
+/**
+*/
+bool CStreamingAdaptor::EnableQuery(int item)
+{
+	if (m_isCopy || !IsOpen())
+	{
+		return false;
+	}
+
+	switch (item) {
+		case VALUE:
+			m_query[QUERY_VALUE] = true;
+			break;
+		case GRADIENT:
+			m_query[QUERY_GRADIENT] = true;
+			break;
+		case GRADIENT_MAGNITUDE:
+			m_query[QUERY_GRADIENT_MAGNITUDE] = true;
+			break;
+		case NORMAL:
+			m_query[QUERY_NORMAL] = true;
+			break;
+		default:
+			std::cerr << "query item " << item << " is not supported when streaming..." << std::endl;
+			return false;
+	}
+
+	UpdatePointers();
+
+	return true;
+}
+
+/**
+Restores the tent value kernel and unsets the derivative kernel.
+*/
+bool CStreamingAdaptor::ResetKernel(void)
+{
+	if (m_isCopy)
+	{
+		return false;
+	}
+
+	const double parameters[NRRD_KERNEL_PARMS_NUM] = {1.0};
+
+	m_kernel[1] = 0;
+
+	return SetKernel(0, nrrdKernelTent, parameters);
+}
+
+/**
+*/
+bool CStreamingAdaptor::SetValueKernel(const NrrdKernel *type, const double *parameters)
+{
+	return SetKernel(0, type, parameters);
+}
+
+/**
+*/
+const NrrdKernel *CStreamingAdaptor::GetValueKernel(double *parameters) const
+{
+	if (m_kernel[0])
+		memcpy(parameters, m_parameters[0], sizeof(m_parameters[0]));
+
+	return m_kernel[0];
+}
+
+/**
+The gradient and the normal are zero until this kernel is set.
+*/
+bool CStreamingAdaptor::Set1stDerivativeKernel(const NrrdKernel *type, const double *parameters)
+{
+	return SetKernel(1, type, parameters);
+}
+
+/**
+Second derivatives are not supported when streaming.
+*/
+bool CStreamingAdaptor::Set2ndDerivativeKernel(const NrrdKernel *, const double *)
+{
+	std::cerr << "second derivatives are not supported when streaming..." << std::endl;
+	return false;
+}
+
+/**
+*/
+int CStreamingAdaptor::GetWidth(void) const
+{
+	return m_cache ? m_cache->GetSize(0) : 0;
+}
+
+/**
+*/
+int CStreamingAdaptor::GetHeight(void) const
+{
+	return m_cache ? m_cache->GetSize(1) : 0;
+}
+
+/**
+*/
+int CStreamingAdaptor::GetDepth(void) const
+{
+	return m_cache ? m_cache->GetSize(2) : 0;
+}
+
+/**
+Bricks always store floats.
+*/
+CGageAdaptor::VALUE_TYPE CStreamingAdaptor::GetType(void) const
+{
+	return FLOAT;
+}
+
+/**
+The volume is never resident as a whole.
+*/
+const GAGE_TYPE *CStreamingAdaptor::GetValueArray(void) const
+{
+	return 0;
+}
+
+/**
+*/
+const CGageAdaptor::ANSWER& CStreamingAdaptor::Probe(float x, float y, float z) const
+{
+	float p[3] = {x, y, z};
+	float local[3];
+
+	Pin(Locate(p, local));
+
+	const bool derivatives = m_query[QUERY_GRADIENT] || m_query[QUERY_GRADIENT_MAGNITUDE] || m_query[QUERY_NORMAL];
+
+	Reconstruct(local, derivatives);
+
+	return m_answer;
+}
+
+/**
+*/
+GAGE_TYPE CStreamingAdaptor::GetValue(float x, float y, float z) const
+{
+	const float p[3] = {x, y, z};
+	GAGE_TYPE value;
+
+	GetValues(p, 1, &value);
+
+	return value;
+}
+
+/**
+Consecutive positions in the same brick are reconstructed together by the
+native sampler.
+*/
+void CStreamingAdaptor::GetValues(const float *positions, unsigned int count, GAGE_TYPE *values) const
+{
+	const bool native = m_native;
+
+	// positions may be m_positions itself: slot i is read before the local
+	// position overwrites it.
+	m_positions.resize(3 * std::max(count, 1u));
+
+	unsigned int run = 0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		float p[3] = {positions[3*i + 0], positions[3*i + 1], positions[3*i + 2]};
+		float *local = &m_positions[3*i];
+		const unsigned int brick = Locate(p, local);
+
+		if (!native)
+		{
+			Pin(brick);
+			Reconstruct(local, false);
+			values[i] = m_value;
+		}
+		else if (brick != m_brickIndex)
+		{
+			if (i > run)
+				m_sampler->Sample(&m_positions[3*run], i - run, values + run);
+
+			Pin(brick);
+			run = i;
+		}
+	}
+
+	if (native && count > run)
+		m_sampler->Sample(&m_positions[3*run], count - run, values + run);
+}
+
+/**
+Prefetches the bricks along the ray, past the last position, before
+reconstructing the values.
+*/
+void CStreamingAdaptor::GetValues(const float *start, const float *step, unsigned int count, GAGE_TYPE *values) const
+{
+	PrefetchAlong(start, step, count);
+
+	m_positions.resize(3 * std::max(count, 1u));
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const float k = (float)i;
+		m_positions[3*i + 0] = start[0] + k * step[0];
+		m_positions[3*i + 1] = start[1] + k * step[1];
+		m_positions[3*i + 2] = start[2] + k * step[2];
+	}
+
+	GetValues(&m_positions[0], count, values);
+}
+
+/**
+*/
+bool CStreamingAdaptor::SetLayout(LAYOUT, unsigned int)
+{
+	return false;
+}
+
+/**
+*/
+const GAGE_TYPE *CStreamingAdaptor::GetNormal(float x, float y, float z) const
+{
+	return Probe(x, y, z).normal;
+}
+
+/**
+*/
+const GAGE_TYPE *CStreamingAdaptor::GetGradient(float x, float y, float z) const
+{
+	return Probe(x, y, z).gradient;
+}
+
+/**
+*/
+GAGE_TYPE CStreamingAdaptor::GetGradientMagnitude(float x, float y, float z) const
+{
+	const GAGE_TYPE *magnitude = Probe(x, y, z).gradientMagnitude;
+
+	return magnitude ? *magnitude : 0;
+}
+
+/**
+*/
+CBrickCache::STATISTICS CStreamingAdaptor::GetCacheStatistics(void) const
+{
+	if (!m_cache)
+	{
+		CBrickCache::STATISTICS statistics;
+		memset(&statistics, 0, sizeof(statistics));
+		return statistics;
+	}
+
+	return m_cache->GetStatistics();
+}
+
+/**
+Maximum memory used by the cached bricks, in bytes.
+*/
+size_t CStreamingAdaptor::GetCacheCapacity(void) const
+{
+	if (!m_cache)
+	{
+		return 0;
+	}
+
+	const size_t edge = m_cache->GetBrickEdge();
+
+	return m_cache->GetCapacity() * edge * edge * edge * sizeof(float);
+}
+
+/**
+The kernels are evaluated on the four voxels around each position, which the
+brick aprons provide.
+*/
+bool CStreamingAdaptor::SetKernel(unsigned int which, const NrrdKernel *type, const double *parameters)
+{
+	if (m_isCopy)
+	{
+		std::cerr << "m_isCopy is true: failed." << std::endl;
+		return false;
+	}
+
+	if (!type || !parameters || type->support(parameters) > 2.0)
+	{
+		std::cerr << "kernels wider than four voxels are not supported when streaming..." << std::endl;
+		return false;
+	}
+
+	m_kernel[which] = type;
+	memset(m_parameters[which], 0, sizeof(m_parameters[which]));
+	memcpy(m_parameters[which], parameters, type->numParm * sizeof(double));
+
+	if (which == 0)
+	{
+		m_native = m_sampler->SetKernel(type, parameters);
+	}
+
+	return true;
+}
+
+/**
+Clamps p to the volume and returns the index of the brick owning its base
+voxel, with local, the position in that brick's voxels.
+*/
+unsigned int CStreamingAdaptor::Locate(float *p, float *local) const
+{
+	const int B = m_cache->GetBrickSize();
+	int base[3];
+
+	for (unsigned int a = 0; a < 3; ++a)
+	{
+		p[a] = std::min(std::max(p[a], 0.0f), (float)(m_cache->GetSize(a) - 1));
+		base[a] = (int)p[a];
+		local[a] = p[a] - (float)(base[a] / B * B) + (float)CBrickCache::APRON_LOW;
+	}
+
+	return m_cache->GetBrickIndex(base[0], base[1], base[2]);
+}
+
+/**
+Makes brick the one read by Reconstruct and the native sampler.
+*/
+void CStreamingAdaptor::Pin(unsigned int brick) const
+{
+	if (brick == m_brickIndex)
+	{
+		return;
+	}
+
+	m_brick = m_cache->GetBrick(brick);
+	m_brickIndex = brick;
+
+	const size_t edge = m_cache->GetBrickEdge();
+	nrrdWrap_va(m_brickNrrd, (void *)&(*m_brick)[0], nrrdTypeFloat, 3, edge, edge, edge);
+	m_sampler->SetVolume(m_brickNrrd);
+}
+
+/**
+Evaluates the value, and the gradient when asked to, at a position local to
+the pinned brick, with the kernels' own weights.
+*/
+void CStreamingAdaptor::Reconstruct(const float *local, bool derivatives) const
+{
+	const float *data = &(*m_brick)[0];
+	const size_t edge = m_cache->GetBrickEdge();
+
+	derivatives = derivatives && m_kernel[1];
+
+	size_t base[3];
+	double w[3][4], d[3][4];
+	for (unsigned int a = 0; a < 3; ++a)
+	{
+		base[a] = (size_t)local[a] - 1;
+		const double t = local[a] - (float)(base[a] + 1);
+		for (unsigned int k = 0; k < 4; ++k)
+		{
+			w[a][k] = m_kernel[0]->eval1_d(t + 1.0 - k, m_parameters[0]);
+			d[a][k] = derivatives ? m_kernel[1]->eval1_d(t + 1.0 - k, m_parameters[1]) : 0.0;
+		}
+	}
+
+	double value = 0.0;
+	double gradient[3] = {0.0, 0.0, 0.0};
+	for (unsigned int k = 0; k < 4; ++k)
+	{
+		for (unsigned int j = 0; j < 4; ++j)
+		{
+			const float *row = data + ((base[2] + k) * edge + base[1] + j) * edge + base[0];
+			for (unsigned int i = 0; i < 4; ++i)
+			{
+				const double v = row[i];
+				value += v * w[0][i] * w[1][j] * w[2][k];
+				if (derivatives)
+				{
+					gradient[0] += v * d[0][i] * w[1][j] * w[2][k];
+					gradient[1] += v * w[0][i] * d[1][j] * w[2][k];
+					gradient[2] += v * w[0][i] * w[1][j] * d[2][k];
+				}
+			}
+		}
+	}
+
+	m_value = (GAGE_TYPE)value;
+
+	const double magnitude = std::sqrt(gradient[0]*gradient[0] + gradient[1]*gradient[1] + gradient[2]*gradient[2]);
+	m_gradientMagnitude = (GAGE_TYPE)magnitude;
+	for (unsigned int a = 0; a < 3; ++a)
+	{
+		m_gradient[a] = (GAGE_TYPE)gradient[a];
+		m_normal[a] = (GAGE_TYPE)(magnitude > 0.0 ? gradient[a] / magnitude : 0.0);
+	}
+}
+
+/**
+Queues the bricks the ray crosses from start to two bricks past its last
+position, stopping where it leaves the volume.
+*/
+void CStreamingAdaptor::PrefetchAlong(const float *start, const float *step, unsigned int count) const
+{
+	const float length = std::sqrt(step[0]*step[0] + step[1]*step[1] + step[2]*step[2]);
+	if (!(length > 0.0f) || !count)
+	{
+		return;
+	}
+
+	const float B = (float)m_cache->GetBrickSize();
+	// Half a brick between lookups, so no brick the ray crosses is missed
+	// by more than a corner.
+	const float stride = 0.5f * B / length;
+	const float end = (float)count + LOOKAHEAD_BRICKS * B / length;
+
+	m_prefetch.clear();
+	for (float s = 0.0f; s <= end; s += stride)
+	{
+		int voxel[3];
+		bool inside = true;
+		for (unsigned int a = 0; a < 3; ++a)
+		{
+			const float p = start[a] + s * step[a];
+			inside = inside && p >= 0.0f && p <= (float)(m_cache->GetSize(a) - 1);
+			voxel[a] = (int)p;
+		}
+
+		if (!inside)
+			break;
+
+		const unsigned int brick = m_cache->GetBrickIndex(voxel[0], voxel[1], voxel[2]);
+		if (brick != m_brickIndex && (m_prefetch.empty() || m_prefetch.back() != brick))
+			m_prefetch.push_back(brick);
+	}
+
+	if (!m_prefetch.empty())
+		m_cache->Prefetch(&m_prefetch[0], (unsigned int)m_prefetch.size());
+}
+
+/**
+Points the answers of the enabled queries to this adaptor's buffers.
+*/
+void CStreamingAdaptor::UpdatePointers(void)
+{
+	m_valuePointer = m_query[QUERY_VALUE] ? &m_value : 0;
+	m_gradientPointer = m_query[QUERY_GRADIENT] ? m_gradient : 0;
+	m_gradientMagnitudePointer = m_query[QUERY_GRADIENT_MAGNITUDE] ? &m_gradientMagnitude : 0;
+	m_normalPointer = m_query[QUERY_NORMAL] ? m_normal : 0;
+
+	m_answer.value = m_valuePointer;
+	m_answer.normal = m_normalPointer;
+	m_answer.gradient = m_gradientPointer;
+	m_answer.gradientMagnitude = m_gradientMagnitudePointer;
+	m_answer.hessian = 0;
+	m_answer.laplacian = 0;
+	m_answer.hessian1stEigenvalue = 0;
+	m_answer.hessian2ndEigenvalue = 0;
+	m_answer.hessian3rdEigenvalue = 0;
+	m_answer.principalCurvature = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef STREAMINGADAPTOR_INCLUDED
+#define STREAMINGADAPTOR_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "GageAdaptor.h"
+#include "BrickCache.h"
+
+/**
+Probes a volume that does not fit in memory, streaming its bricks from a
+brick file written by CBrickCache::Create. Reconstruction runs on the cached
+bricks instead of through gage. The value and first derivative kernels can be
+any kernel with a support of at most four voxels; tent and BC cubic values
+run on the native sampler. The VALUE, GRADIENT, GRADIENT_MAGNITUDE and NORMAL
+queries are supported. Positions are clamped to the volume.
+
+Clones share the brick cache. Batched probes prefetch the bricks further
+along the ray in the background.
+*/
+class CStreamingAdaptor
+	: public CGageAdaptor
+{
+public:
+	// Default cache size, in bytes.
+	enum { DEFAULT_CACHE_SIZE = 512 << 20 };
+	CStreamingAdaptor(void);
+	virtual ~CStreamingAdaptor(void);
+	virtual bool Open(const std::string& path);
+	bool Open(const std::string& path, size_t cacheSize);
+	virtual bool OpenMapped(const std::string& path);
+	virtual bool OpenFromMemory(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth);
+	virtual bool OpenFromExternalMemory(void *data, VALUE_TYPE type, unsigned int width, unsigned int height, unsigned int depth);
+	virtual boost::shared_ptr<CGageAdaptor> Clone(void) const;
+	virtual void Close(void);
+	virtual bool EnableQuery(int item);
+	virtual bool ResetKernel(void);
+	virtual bool SetValueKernel(const NrrdKernel *type, const double *parameters);
+	virtual const NrrdKernel *GetValueKernel(double *parameters) const;
+	virtual bool Set1stDerivativeKernel(const NrrdKernel *type, const double *parameters);
+	virtual bool Set2ndDerivativeKernel(const NrrdKernel *type, const double *parameters);
+	virtual int GetWidth(void) const;
+	virtual int GetHeight(void) const;
+	virtual int GetDepth(void) const;
+	virtual VALUE_TYPE GetType(void) const;
+	virtual const GAGE_TYPE *GetValueArray(void) const;
+	virtual const ANSWER& Probe(float x, float y, float z) const;
+	virtual GAGE_TYPE GetValue(float x, float y, float z) const;
+	virtual void GetValues(const float *positions, unsigned int count, GAGE_TYPE *values) const;
+	virtual void GetValues(const float *start, const float *step, unsigned int count, GAGE_TYPE *values) const;
+	virtual bool SetLayout(LAYOUT layout, unsigned int brickSize);
+	virtual const GAGE_TYPE *GetNormal(float x, float y, float z) const;
+	virtual const GAGE_TYPE *GetGradient(float x, float y, float z) const;
+	virtual GAGE_TYPE GetGradientMagnitude(float x, float y, float z) const;
+	CBrickCache::STATISTICS GetCacheStatistics(void) const;
+	size_t GetCacheCapacity(void) const;
+private:
+	bool SetKernel(unsigned int which, const NrrdKernel *type, const double *parameters);
+	unsigned int Locate(float *p, float *local) const;
+	void Pin(unsigned int brick) const;
+	void Reconstruct(const float *local, bool derivatives) const;
+	void PrefetchAlong(const float *start, const float *step, unsigned int count) const;
+	void UpdatePointers(void);
+protected:
+	boost::shared_ptr<CBrickCache> m_cache;
+	// Brick read by the last probe and the Nrrd wrapping it for the sampler.
+	mutable CBrickCache::BRICK m_brick;
+	mutable unsigned int m_brickIndex;
+	Nrrd *m_brickNrrd;
+	mutable std::vector<float> m_positions;
+	mutable std::vector<unsigned int> m_prefetch;
+
+	// Value and first derivative kernels.
+	const NrrdKernel *m_kernel[2];
+	double m_parameters[2][NRRD_KERNEL_PARMS_NUM];
+	// Whether the native sampler supports the value kernel.
+	bool m_native;
+	bool m_query[4];
+
+	mutable GAGE_TYPE m_value;
+	mutable GAGE_TYPE m_gradient[3];
+	mutable GAGE_TYPE m_gradientMagnitude;
+	mutable GAGE_TYPE m_normal[3];
+};
+
+#endif // STREAMINGADAPTOR_INCLUDED
@@ -0,0 +1,423 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cmath>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "GageAdaptor.h"
+#include "render.h"
+#include "exponential.h"
+
+/**
+ * Hardware event counter of the calling thread, through perf_event_open.
+ * valid() is false where the counter is not available (not on Linux, no
+ * permission, virtual machines without a PMU).
+ */
+class PerfCounter
+{
+public:
+    enum Event
+    {
+        L1D_READ_MISSES,
+        LLC_MISSES
+    };
+
+    PerfCounter(Event event) : m_fd(-1)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        if(event == L1D_READ_MISSES)
+        {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+        else
+        {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+        (void)event;
+#endif
+    }
+    ~PerfCounter()
+    {
+#ifdef __linux__
+        if(m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+    bool valid() const
+    {
+        return m_fd >= 0;
+    }
+    void start()
+    {
+#ifdef __linux__
+        if(valid())
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    long long stop()
+    {
+        long long count = -1;
+#ifdef __linux__
+        if(valid())
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if(read(m_fd, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        }
+#endif
+        return count;
+    }
+private:
+    PerfCounter(const PerfCounter&);
+    PerfCounter& operator=(const PerfCounter&);
+
+    int m_fd;
+};
+
+/**
+ * Samples a bundle of parallel rays through the volume with the batched
+ * probes, for the linear and the bricked layouts, along each axis and two
+ * oblique directions. Reports samples/s and the L1 data and last level cache
+ * misses per sample.
+ */
+inline
+void benchmark_layout(CGageAdaptor& image, unsigned brick_size, double step)
+{
+    struct Direction
+    {
+        const char *name;
+        double d[3];
+    };
+    const Direction directions[] = {
+        {"x",     {1.0, 0.0, 0.0}},
+        {"y",     {0.0, 1.0, 0.0}},
+        {"z",     {0.0, 0.0, 1.0}},
+        {"1,1,1", {1.0, 1.0, 1.0}},
+        {"1,2,3", {1.0, 2.0, 3.0}}
+    };
+    const CGageAdaptor::LAYOUT layouts[] = {CGageAdaptor::LINEAR_LAYOUT, CGageAdaptor::BRICKED_LAYOUT};
+    const unsigned R = 64;
+
+    const double size[3] = {double(image.GetWidth()), double(image.GetHeight()), double(image.GetDepth())};
+    const double center[3] = {0.5 * (size[0] - 1), 0.5 * (size[1] - 1), 0.5 * (size[2] - 1)};
+    const double diagonal = magnitue(size);
+
+    std::vector<GAGE_TYPE> values;
+
+    std::cout << std::setw(10) << "layout" << std::setw(8) << "ray"
+              << std::setw(14) << "samples/s"
+              << std::setw(14) << "L1D miss/smp"
+              << std::setw(14) << "LLC miss/smp" << std::endl;
+
+    for(CGageAdaptor::LAYOUT layout : layouts)
+    {
+        if(!image.SetLayout(layout, brick_size))
+        {
+            std::cerr << "set layout failed..." << std::endl;
+            return;
+        }
+
+        for(const Direction& direction : directions)
+        {
+            double dir[3], u[3], v[3];
+            const double l = magnitue(direction.d);
+            for(unsigned i = 0; i < 3; ++i)
+                dir[i] = direction.d[i] / l;
+
+            // Orthonormal basis of the plane the rays start from.
+            const double a[3] = {std::fabs(dir[0]) < 0.9 ? 1.0 : 0.0, std::fabs(dir[0]) < 0.9 ? 0.0 : 1.0, 0.0};
+            u[0] = dir[1]*a[2] - dir[2]*a[1];
+            u[1] = dir[2]*a[0] - dir[0]*a[2];
+            u[2] = dir[0]*a[1] - dir[1]*a[0];
+            const double lu = magnitue(u);
+            for(unsigned i = 0; i < 3; ++i)
+                u[i] /= lu;
+            v[0] = dir[1]*u[2] - dir[2]*u[1];
+            v[1] = dir[2]*u[0] - dir[0]*u[2];
+            v[2] = dir[0]*u[1] - dir[1]*u[0];
+
+            PerfCounter l1(PerfCounter::L1D_READ_MISSES);
+            PerfCounter llc(PerfCounter::LLC_MISSES);
+
+            size_t samples = 0;
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            l1.start();
+            llc.start();
+            for(unsigned j = 0; j < R; ++j)
+            {
+                for(unsigned i = 0; i < R; ++i)
+                {
+                    const double s = diagonal * ((i + 0.5) / R - 0.5);
+                    const double t = diagonal * ((j + 0.5) / R - 0.5);
+                    double origin[3];
+                    for(unsigned k = 0; k < 3; ++k)
+                        origin[k] = center[k] + s * u[k] + t * v[k] - diagonal * dir[k];
+
+                    double t0, t1;
+                    if(!clip_ray(image, origin, dir, t0, t1))
+                        continue;
+
+                    const unsigned count = unsigned((t1 - t0) / step) + 1;
+                    const float start[3] = {float(origin[0] + t0 * dir[0]),
+                                            float(origin[1] + t0 * dir[1]),
+                                            float(origin[2] + t0 * dir[2])};
+                    const float delta[3] = {float(step * dir[0]), float(step * dir[1]), float(step * dir[2])};
+                    values.resize(count);
+                    image.GetValues(start, delta, count, &values[0]);
+                    samples += count;
+                }
+            }
+            const long long l1_misses = l1.stop();
+            const long long llc_misses = llc.stop();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            std::cout << std::setw(10) << (layout == CGageAdaptor::LINEAR_LAYOUT ? "linear" : "bricked")
+                      << std::setw(8) << direction.name
+                      << std::setw(14) << samples / seconds;
+            if(l1_misses >= 0)
+                std::cout << std::setw(14) << double(l1_misses) / samples;
+            else
+                std::cout << std::setw(14) << "n/a";
+            if(llc_misses >= 0)
+                std::cout << std::setw(14) << double(llc_misses) / samples;
+            else
+                std::cout << std::setw(14) << "n/a";
+            std::cout << std::endl;
+        }
+    }
+}
+
+/**
+ * Integrates the analytic VRI_solution_00 over [0, 1] with n points for
+ * every combination of methods Integrator::outer() supports, through the
+ * kernels specialized at compile time and through outer_dynamic(), which
+ * tests the methods at every sample. Reports the time per point of both and
+ * the speedup.
+ */
+template<typename Real>
+void benchmark_dispatch(unsigned n)
+{
+    typedef OuterKernels< Real, VRI_solution_00<Real> > Kernels;
+    const Real start[3] = {0.0, 0.0, 0.0};
+    const Real end[3] = {1.0, 0.0, 0.0};
+    const VRI_solution_00<Real> solve(start, end);
+    const Real d = Real(1.0) / (n - 1);
+    const double min_seconds = 0.05;
+    Integrator<Real> integrator;
+
+    // Evenly spread positions for MONTE_CARLO, so that both runs see the
+    // same ones.
+    std::vector<Real> samples(n);
+    for(unsigned j = 0; j < n; ++j)
+        samples[j] = (j + 0.5) / n;
+
+    std::cout << std::setw(20) << "outer" << std::setw(20) << "inner" << std::setw(11) << "exp"
+              << std::setw(14) << "dynamic ns/pt"
+              << std::setw(14) << "static ns/pt"
+              << std::setw(9) << "speedup" << std::endl;
+
+    for(Method o : Kernels::OUTER)
+    {
+        for(Method i : Kernels::INNER)
+        {
+            for(Method e : Kernels::EXP)
+            {
+                if(!Kernels::supports(o, i, e))
+                    continue;
+
+                double seconds[2];
+                Real result[2];
+                for(unsigned k = 0; k < 2; ++k)
+                {
+                    size_t runs = 0;
+                    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                    do
+                    {
+                        result[k] = k ? integrator.outer(solve, d, n, o, i, e, samples)
+                                      : integrator.outer_dynamic(solve, d, n, o, i, e, samples);
+                        ++runs;
+                        seconds[k] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+                    }
+                    while(seconds[k] < min_seconds);
+                    seconds[k] /= runs;
+                }
+
+                std::cout << std::setw(20) << getMethodName(o) << std::setw(20) << getMethodName(i)
+                          << std::setw(11) << getMethodName(e)
+                          << std::setw(14) << 1e9 * seconds[0] / n
+                          << std::setw(14) << 1e9 * seconds[1] / n
+                          << std::setw(9) << seconds[0] / seconds[1];
+                if(result[0] != result[1])
+                    std::cout << "  results differ by " << std::fabs(double(result[0] - result[1]));
+                std::cout << std::endl;
+            }
+        }
+    }
+}
+
+// std::exp in the interface of the approximations of exponential.h.
+struct ExactExponential
+{
+    template<typename Real>
+    static inline void evaluate(const Real *s, Real *values, size_t count)
+    {
+        for(size_t k = 0; k < count; ++k)
+            values[k] = exp(-s[k]);
+    }
+};
+
+/**
+ * One row of benchmark_exponential(): the time per value of Approximation
+ * over the batch s, its ratio to the time of std::exp, and its largest
+ * relative error for s up to 0.01, 0.1 and 1. Returns the time per value.
+ */
+template<typename Approximation, typename Real>
+double benchmark_approximation(const char *name, const char *method, unsigned order,
+                               const std::vector<Real>& s, double exp_seconds)
+{
+    const double min_seconds = 0.05;
+    std::vector<Real> values(s.size());
+
+    size_t runs = 0;
+    double seconds = 0.0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    do
+    {
+        Approximation::evaluate(&s[0], &values[0], s.size());
+        ++runs;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+    while(seconds < min_seconds);
+    seconds /= double(runs) * s.size();
+
+    double error[3] = {0.0, 0.0, 0.0};
+    const double limits[3] = {0.01, 0.1, 1.0};
+    for(size_t k = 0; k < s.size(); ++k)
+    {
+        const double e = std::fabs(double((values[k] - exp(-s[k])) / exp(-s[k])));
+        for(unsigned l = 0; l < 3; ++l)
+            if(double(s[k]) <= limits[l])
+                error[l] = std::max(error[l], e);
+    }
+
+    std::cout << std::setw(12) << name << std::setw(11) << method << std::setw(7);
+    if(order)
+        std::cout << order;
+    else
+        std::cout << "-";
+    std::cout << std::setw(12) << 1e9 * seconds
+              << std::setw(9) << (exp_seconds > 0.0 ? exp_seconds / seconds : 1.0)
+              << std::setw(14) << error[0] << std::setw(14) << error[1] << std::setw(14) << error[2]
+              << std::endl;
+    return seconds;
+}
+
+/**
+ * The attenuate row of benchmark_exponential(): the time per segment of
+ * attenuate() with Approximation over a ray split into the segments s / n,
+ * whose transmittance stays far from underflow, its ratio to the time of
+ * std::exp, and the largest relative error of the transmittance after each
+ * segment, all of optical depth below 0.01.
+ */
+template<typename Approximation, typename Real>
+void benchmark_attenuate(const char *name, const char *method, const std::vector<Real>& s,
+                         double exp_seconds)
+{
+    const double min_seconds = 0.05;
+    std::vector<Real> segments(s.size());
+    for(size_t k = 0; k < s.size(); ++k)
+        segments[k] = s[k] / Real(s.size());
+    std::vector<Real> values(s.size());
+
+    size_t runs = 0;
+    double seconds = 0.0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    do
+    {
+        attenuate<Approximation>(Real(1.0), &segments[0], &values[0], segments.size());
+        ++runs;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+    while(seconds < min_seconds);
+    seconds /= double(runs) * s.size();
+
+    double error = 0.0;
+    CompensatedSum<Real> tau;
+    for(size_t k = 0; k < segments.size(); ++k)
+    {
+        tau += segments[k];
+        const Real alpha = exp(-tau.value());
+        error = std::max(error, std::fabs(double((values[k] - alpha) / alpha)));
+    }
+
+    std::cout << std::setw(12) << name << std::setw(11) << method << std::setw(7) << "-"
+              << std::setw(12) << 1e9 * seconds
+              << std::setw(9) << exp_seconds / seconds
+              << std::setw(14) << error << std::setw(14) << "-" << std::setw(14) << "-"
+              << std::endl;
+}
+
+/**
+ * Evaluates the Taylor polynomials and the diagonal Pade approximants of
+ * exp(-s) of exponential.h, and std::exp, on a batch of n optical depths
+ * spread over [0, 1]. Reports for each the order of its error in s, the
+ * time per value, the speedup over std::exp, and the largest relative error
+ * for segments of optical depth up to 0.01, 0.1 and 1, to pick the cheapest
+ * approximation that meets the accuracy of the outer rule, and the cost of
+ * the running product of attenuate() on top of std::exp. method is the
+ * --exp method of the approximation, if any.
+ */
+template<typename Real>
+void benchmark_exponential(unsigned n)
+{
+    std::vector<Real> s(n);
+    for(unsigned k = 0; k < n; ++k)
+        s[k] = (k + 0.5) / n;
+
+    std::cout << std::setw(12) << "approx" << std::setw(11) << "--exp" << std::setw(7) << "order"
+              << std::setw(12) << "ns/value" << std::setw(9) << "speedup"
+              << std::setw(14) << "err s<=0.01" << std::setw(14) << "err s<=0.1" << std::setw(14) << "err s<=1"
+              << std::endl;
+
+    const double e = benchmark_approximation<ExactExponential>("std::exp", "EXACT", 0, s, 0.0);
+    benchmark_attenuate<ExactExponential>("attenuate", "EXACT", s, e);
+    benchmark_approximation< Taylor<1> >("TAYLOR<1>", "QUADRATIC", 2, s, e);
+    benchmark_approximation< Taylor<2> >("TAYLOR<2>", "CUBIC", 3, s, e);
+    benchmark_approximation< Taylor<3> >("TAYLOR<3>", "QUARTIC", 4, s, e);
+    benchmark_approximation< Taylor<4> >("TAYLOR<4>", "QUINTIC", 5, s, e);
+    benchmark_approximation< Taylor<6> >("TAYLOR<6>", "", 7, s, e);
+    benchmark_approximation< Taylor<8> >("TAYLOR<8>", "", 9, s, e);
+    benchmark_approximation< Pade<1, 1> >("PADE<1,1>", "PADE_1_1", 3, s, e);
+    benchmark_approximation< Pade<2, 2> >("PADE<2,2>", "PADE_2_2", 5, s, e);
+    benchmark_approximation< Pade<3, 3> >("PADE<3,3>", "PADE_3_3", 7, s, e);
+    benchmark_approximation< Pade<4, 4> >("PADE<4,4>", "", 9, s, e);
+}
+
+#endif // BENCHMARK_H
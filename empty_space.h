@@ -0,0 +1,267 @@
+#ifndef EMPTY_SPACE_H
+#define EMPTY_SPACE_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <utility>
+
+#include "MinMaxGrid.h"
+#include "transfer_function.h"
+
+/**
+ * Macro-cells of a CMinMaxGrid where the extinction transfer function is
+ * zero for every value the cell can reconstruct. Rays can jump over them:
+ * both the emission and the optical depth vanish there.
+ *
+ * classify() looks at every cell. reclassify() only revisits the cells whose
+ * range overlaps the values where the transfer function changed between zero
+ * and non-zero, which is what an interactive transfer function editor needs.
+ *
+ * classify_uniform() also marks the cells where the emission and the
+ * extinction are constant, which ADAPTIVE_RK steps across.
+ */
+template<typename Real>
+struct EmptySpace
+{
+    explicit EmptySpace(const CMinMaxGrid& grid) : m_grid(grid)
+    {
+        // Cells by increasing minimum, so that reclassify() can stop at the
+        // first cell above the changed values.
+        m_by_min.resize(grid.GetCellCount());
+        for(size_t c = 0; c < m_by_min.size(); ++c)
+            m_by_min[c] = c;
+        std::sort(m_by_min.begin(), m_by_min.end(), [&grid](size_t a, size_t b)
+        {
+            return grid.GetMin(a) < grid.GetMin(b);
+        });
+    }
+
+    void classify(const TransferFunction<Real>& transparency)
+    {
+        set_function(transparency);
+        m_empty.resize(m_grid.GetCellCount());
+        for(size_t c = 0; c < m_empty.size(); ++c)
+            m_empty[c] = is_empty(c);
+    }
+
+    /**
+     * Classifies the cells, and marks as uniform the empty ones and those
+     * where both transfer functions are constant over the range of the
+     * cell. Without color, for shaded samples whose color varies with the
+     * normal anyway, only the empty ones.
+     */
+    void classify_uniform(const TransferFunction<Real>& transparency, const TransferFunction<Real> *color)
+    {
+        classify(transparency);
+        m_uniform.resize(m_empty.size());
+        for(size_t c = 0; c < m_uniform.size(); ++c)
+            m_uniform[c] = m_empty[c] or
+                           (color and is_constant(transparency, c) and is_constant(*color, c));
+    }
+
+    // Returns the number of cells that were looked at again.
+    size_t reclassify(const TransferFunction<Real>& transparency)
+    {
+        if(m_empty.empty() or
+           transparency.m_table.size() != m_table.size() or
+           transparency.m_min != m_min or transparency.m_max != m_max)
+        {
+            classify(transparency);
+            return m_empty.size();
+        }
+
+        // Table entries that switched between zero and non-zero.
+        size_t first = m_table.size(), last = 0;
+        for(size_t i = 0; i < m_table.size(); ++i)
+        {
+            if((m_table[i] != 0.0) != (transparency.m_table[i] != 0.0))
+            {
+                first = std::min(first, i);
+                last = std::max(last, i);
+            }
+        }
+
+        set_function(transparency);
+        if(first > last)
+            return 0;
+
+        // Values interpolated from those entries.
+        const Real lo = first == 0 ? -std::numeric_limits<Real>::max() : value(first - 1);
+        const Real hi = last + 1 >= m_table.size() ? std::numeric_limits<Real>::max() : value(last + 1);
+
+        size_t visited = 0;
+        for(size_t k = 0; k < m_by_min.size() and m_grid.GetMin(m_by_min[k]) <= hi; ++k)
+        {
+            const size_t c = m_by_min[k];
+            if(m_grid.GetMax(c) < lo)
+                continue;
+            m_empty[c] = is_empty(c);
+            ++visited;
+        }
+        return visited;
+    }
+
+    inline bool empty(size_t cell) const
+    {
+        return m_empty[cell] != 0;
+    }
+
+    inline bool uniform(size_t cell) const
+    {
+        return m_uniform[cell] != 0;
+    }
+
+    size_t empty_cells() const
+    {
+        return size_t(std::count(m_empty.begin(), m_empty.end(), 1));
+    }
+
+    size_t uniform_cells() const
+    {
+        return size_t(std::count(m_uniform.begin(), m_uniform.end(), 1));
+    }
+
+    /**
+     * Parameter ranges [a, b] of origin + t * dir, within [t0, t1], that
+     * cross non-empty cells, in increasing order.
+     */
+    void segments(const Real *origin, const Real *dir, Real t0, Real t1,
+                  std::vector< std::pair<Real, Real> >& ranges) const
+    {
+        walk(origin, dir, t0, t1, ranges, [this](size_t cell) { return !empty(cell); });
+    }
+
+    // The same for the ranges that cross uniform cells, after
+    // classify_uniform().
+    void uniform_segments(const Real *origin, const Real *dir, Real t0, Real t1,
+                          std::vector< std::pair<Real, Real> >& ranges) const
+    {
+        walk(origin, dir, t0, t1, ranges, [this](size_t cell) { return uniform(cell); });
+    }
+
+    const CMinMaxGrid& m_grid;
+    std::vector<unsigned char> m_empty;
+    std::vector<unsigned char> m_uniform;
+    std::vector<size_t> m_by_min;
+    // Transfer function the cells were classified with, and the number of
+    // non-zero entries before each entry.
+    std::vector<Real> m_table;
+    std::vector<size_t> m_nonzero;
+    Real m_min;
+    Real m_max;
+
+private:
+    // Ranges crossing the cells where selected is true, walking the cells
+    // the ray crosses with a 3D DDA.
+    template<typename Selected>
+    void walk(const Real *origin, const Real *dir, Real t0, Real t1,
+              std::vector< std::pair<Real, Real> >& ranges, const Selected& selected) const
+    {
+        ranges.clear();
+
+        const Real B = m_grid.GetCellSize();
+        int cell[3], step[3];
+        Real next[3], delta[3];
+        for(unsigned a = 0; a < 3; ++a)
+        {
+            const Real p = origin[a] + t0 * dir[a];
+            cell[a] = std::min(std::max(int(std::floor(p / B)), 0), m_grid.GetCells(a) - 1);
+            if(dir[a] > 0.0)
+            {
+                step[a] = 1;
+                delta[a] = B / dir[a];
+                next[a] = ((cell[a] + 1) * B - origin[a]) / dir[a];
+            }
+            else if(dir[a] < 0.0)
+            {
+                step[a] = -1;
+                delta[a] = -B / dir[a];
+                next[a] = (cell[a] * B - origin[a]) / dir[a];
+            }
+            else
+            {
+                step[a] = 0;
+                delta[a] = next[a] = std::numeric_limits<Real>::max();
+            }
+        }
+
+        Real t = t0;
+        while(t < t1)
+        {
+            const unsigned a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2)
+                                                 : (next[1] < next[2] ? 1 : 2);
+            const Real exit = std::max(t, std::min(next[a], t1));
+
+            if(selected(m_grid.GetCellIndex(cell[0], cell[1], cell[2])))
+            {
+                if(!ranges.empty() and ranges.back().second >= t)
+                    ranges.back().second = exit;
+                else
+                    ranges.push_back(std::make_pair(t, exit));
+            }
+
+            t = exit;
+            cell[a] += step[a];
+            next[a] += delta[a];
+            if(cell[a] < 0 or cell[a] >= m_grid.GetCells(a))
+                break;
+        }
+    }
+
+    void set_function(const TransferFunction<Real>& transparency)
+    {
+        m_table = transparency.m_table;
+        m_min = transparency.m_min;
+        m_max = transparency.m_max;
+        m_nonzero.assign(m_table.size() + 1, 0);
+        for(size_t i = 0; i < m_table.size(); ++i)
+            m_nonzero[i+1] = m_nonzero[i] + (m_table[i] != 0.0);
+    }
+
+    // Value of table entry i.
+    inline Real value(size_t i) const
+    {
+        return m_min + (m_max - m_min) * Real(i) / Real(m_table.size() - 1);
+    }
+
+    // Fractional table position of v, clamped to the table.
+    inline Real entry(Real v) const
+    {
+        const Real t = (v - m_min) / (m_max - m_min) * (m_table.size() - 1);
+        return std::min(std::max(t, Real(0.0)), Real(m_table.size() - 1));
+    }
+
+    // The transfer function interpolates linearly between entries, so it is
+    // zero over [min, max] when every entry it interpolates there is zero.
+    inline bool is_empty(size_t c) const
+    {
+        if(m_table.empty())
+            return true;
+        const size_t i0 = size_t(std::floor(entry(m_grid.GetMin(c))));
+        const size_t i1 = size_t(std::ceil(entry(m_grid.GetMax(c))));
+        return m_nonzero[i1 + 1] == m_nonzero[i0];
+    }
+
+    // Whether function is constant over [min, max] of cell c: every entry
+    // it interpolates there is the same.
+    inline bool is_constant(const TransferFunction<Real>& function, size_t c) const
+    {
+        const std::vector<Real>& table = function.m_table;
+        if(table.empty())
+            return true;
+        const Real scale = (table.size() - 1) / (function.m_max - function.m_min);
+        const Real t0 = (m_grid.GetMin(c) - function.m_min) * scale;
+        const Real t1 = (m_grid.GetMax(c) - function.m_min) * scale;
+        const Real last = Real(table.size() - 1);
+        const size_t i0 = size_t(std::floor(std::min(std::max(t0, Real(0.0)), last)));
+        const size_t i1 = size_t(std::ceil(std::min(std::max(t1, Real(0.0)), last)));
+        for(size_t i = i0 + 1; i <= i1; ++i)
+            if(table[i] != table[i0])
+                return false;
+        return true;
+    }
+};
+
+#endif // EMPTY_SPACE_H
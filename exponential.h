@@ -0,0 +1,210 @@
+#ifndef EXPONENTIAL_H
+#define EXPONENTIAL_H
+
+#include <cstddef>
+
+#include "precision.h"
+
+/**
+ * Approximations of exp(-s), the transmittance of a segment of optical depth
+ * s: the Taylor polynomials of degree K and the Pade approximants of degrees
+ * P over Q. Their coefficients are computed by the compiler and the
+ * polynomials evaluated with Horner's scheme, one multiplication and one
+ * addition per degree. Each evaluates one s, or a batch of independent ones
+ * in blocks the compiler vectorizes.
+ */
+
+// Product of the integers m to n, 1 when m > n.
+template<typename Real>
+constexpr Real factorial_ratio(unsigned m, unsigned n)
+{
+    Real r = 1;
+    for(unsigned k = m; k <= n; ++k)
+        r = r * Real(k);
+    return r;
+}
+
+// The polynomial c[K] + c[K+1] s + ... + c[D] s^(D-K), unrolled by the
+// compiler into D - K multiply-adds.
+template<typename Real, unsigned D, unsigned K = 0>
+struct Horner
+{
+    static inline Real evaluate(const Real *c, Real s)
+    {
+        return Horner<Real, D, K + 1>::evaluate(c, s) * s + c[K];
+    }
+};
+
+template<typename Real, unsigned D>
+struct Horner<Real, D, D>
+{
+    static inline Real evaluate(const Real *c, Real)
+    {
+        return c[D];
+    }
+};
+
+/**
+ * values[k] = Approximation::evaluate(s[k]), in blocks of a fixed width
+ * through local copies, which the compiler vectorizes without having to
+ * check s and values for overlap, and the rest one at a time.
+ */
+template<typename Approximation, typename Real>
+inline void evaluate_batch(const Real *s, Real *values, size_t count)
+{
+    enum { WIDTH = 8 };
+    size_t k = 0;
+    for(; k + WIDTH <= count; k += WIDTH)
+    {
+        Real x[WIDTH];
+        for(unsigned j = 0; j < WIDTH; ++j)
+            x[j] = s[k + j];
+        for(unsigned j = 0; j < WIDTH; ++j)
+            x[j] = Approximation::evaluate(x[j]);
+        for(unsigned j = 0; j < WIDTH; ++j)
+            values[k + j] = x[j];
+    }
+    for(; k < count; ++k)
+        values[k] = Approximation::evaluate(s[k]);
+}
+
+template<typename Real, unsigned D>
+struct Polynomial
+{
+    Real c[D + 1];
+};
+
+// (-1)^k / k!, the coefficients of the Taylor polynomial of exp(-s).
+template<typename Real, unsigned K>
+constexpr Polynomial<Real, K> taylor_coefficients()
+{
+    Polynomial<Real, K> p{};
+    for(unsigned k = 0; k <= K; ++k)
+        p.c[k] = (k % 2 ? Real(-1) : Real(1)) / factorial_ratio<Real>(1, k);
+    return p;
+}
+
+/**
+ * Coefficients in s of the numerator, or of the denominator, of the Pade
+ * approximant of exp(x) of degrees P over Q, for x = -s:
+ *
+ *     sum_j (P + Q - j)! P! / ((P + Q)! j! (P - j)!) x^j    and
+ *     sum_j (P + Q - j)! Q! / ((P + Q)! j! (Q - j)!) (-x)^j
+ */
+template<typename Real, unsigned P, unsigned Q, bool numerator>
+constexpr Polynomial<Real, numerator ? P : Q> pade_coefficients()
+{
+    constexpr unsigned D = numerator ? P : Q;
+    Polynomial<Real, D> p{};
+    for(unsigned j = 0; j <= D; ++j)
+    {
+        // (P + Q - j)! D! / ((P + Q)! (D - j)!) / j!
+        const Real c = factorial_ratio<Real>(D - j + 1, D) /
+                       factorial_ratio<Real>(P + Q - j + 1, P + Q) / factorial_ratio<Real>(1, j);
+        p.c[j] = numerator and j % 2 ? -c : c;
+    }
+    return p;
+}
+
+template<typename Real>
+struct ExpPrecision
+{
+    typedef long double type;
+};
+
+#ifdef VRI_QUAD
+template<>
+struct ExpPrecision<__float128>
+{
+    typedef __float128 type;
+};
+#endif
+
+template<typename Real, typename Work, unsigned D>
+constexpr Polynomial<Real, D> exp_round(const Polynomial<Work, D>& work)
+{
+    Polynomial<Real, D> p{};
+    for(unsigned k = 0; k <= D; ++k)
+        p.c[k] = Real(work.c[k]);
+    return p;
+}
+
+// The Taylor polynomial of exp(-s) of degree K, with an error of order
+// s^(K+1).
+template<unsigned K>
+struct Taylor
+{
+    template<typename Real>
+    struct Coefficients
+    {
+        static constexpr Polynomial<Real, K> p =
+            exp_round<Real>(taylor_coefficients<typename ExpPrecision<Real>::type, K>());
+    };
+
+    template<typename Real>
+    static inline Real evaluate(Real s)
+    {
+        return Horner<Real, K>::evaluate(Coefficients<Real>::p.c, s);
+    }
+
+    template<typename Real>
+    static inline void evaluate(const Real *s, Real *values, size_t count)
+    {
+        evaluate_batch<Taylor>(s, values, count);
+    }
+};
+
+template<unsigned K> template<typename Real>
+constexpr Polynomial<Real, K> Taylor<K>::Coefficients<Real>::p;
+
+// The Pade approximant of exp(-s) of degrees P over Q, with an error of order
+// s^(P+Q+1). The diagonal ones, P = Q, are 1 / themselves at -s as exp is,
+// and stay in [-1, 1] for any s >= 0.
+template<unsigned P, unsigned Q>
+struct Pade
+{
+    template<typename Real>
+    struct Coefficients
+    {
+        static constexpr Polynomial<Real, P> numerator =
+            exp_round<Real>(pade_coefficients<typename ExpPrecision<Real>::type, P, Q, true>());
+        static constexpr Polynomial<Real, Q> denominator =
+            exp_round<Real>(pade_coefficients<typename ExpPrecision<Real>::type, P, Q, false>());
+    };
+
+    template<typename Real>
+    static inline Real evaluate(Real s)
+    {
+        return Horner<Real, P>::evaluate(Coefficients<Real>::numerator.c, s) /
+               Horner<Real, Q>::evaluate(Coefficients<Real>::denominator.c, s);
+    }
+
+    template<typename Real>
+    static inline void evaluate(const Real *s, Real *values, size_t count)
+    {
+        evaluate_batch<Pade>(s, values, count);
+    }
+};
+
+template<unsigned P, unsigned Q> template<typename Real>
+constexpr Polynomial<Real, P> Pade<P, Q>::Coefficients<Real>::numerator;
+template<unsigned P, unsigned Q> template<typename Real>
+constexpr Polynomial<Real, Q> Pade<P, Q>::Coefficients<Real>::denominator;
+
+/**
+ * Transmittance update of a batch of consecutive segments of optical depths
+ * s: values[k] receives the transmittance after segment k, alpha times the
+ * approximations of exp(-s) of the segments up to k. The approximations are
+ * evaluated all at once first, only the running product is sequential.
+ * Returns the transmittance after the batch.
+ */
+template<typename Approximation, typename Real>
+inline Real attenuate(Real alpha, const Real *s, Real *values, size_t count)
+{
+    Approximation::evaluate(s, values, count);
+    for(size_t k = 0; k < count; ++k)
+        values[k] = alpha = alpha * values[k];
+    return alpha;
+}
+
+#endif // EXPONENTIAL_H
@@ -0,0 +1,121 @@
+#ifndef EXTRAPOLATION_H
+#define EXTRAPOLATION_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "integration.h"
+
+/**
+ * Order of the error of a method in its part of the integral: the error of
+ * the outer rule, of the optical depth of the inner rule, and of the
+ * transmittance of the truncated exponential series. EXACT does not add an
+ * error, 0 is returned for the methods whose error has no expansion in
+ * powers of the step (MONTE_CARLO, and LINEAR which does not converge).
+ */
+inline
+unsigned getOrder(Method m)
+{
+    switch(m)
+    {
+    case RIEMANN:               return 1;
+    case TRAPEZOID:             return 2;
+    case SIMPSON:               return 4;
+    case BOOLE:                 return 6;
+    case GAUSS_QUADRATURE:      return 4;
+    case GAUSS_QUADRATURE_5:    return 6;
+    case GAUSS_LEGENDRE_8:      return 16;
+    case GAUSS_LEGENDRE_20:     return 40;
+    case GAUSS_KRONROD_15:      return 24;
+    case GAUSS_KRONROD_21:      return 32;
+    case QUADRATIC:             return 1;
+    case CUBIC:                 return 2;
+    case QUARTIC:               return 3;
+    case QUINTIC:               return 4;
+    case PADE_1_1:              return 2;
+    case PADE_2_2:              return 4;
+    case PADE_3_3:              return 6;
+    case EXACT:                 return unsigned(-1);
+    default:                    return 0;
+    }
+}
+
+/**
+ * Error expansion of the combined methods, c_0 d^p + c_1 d^(p+q) + ..., as
+ * its leading order p and the increment q between its orders. The leading
+ * order is the lowest of the three methods. Only even powers remain when
+ * the outer and inner rules are symmetric, as the trapezoid, Simpson, Boole
+ * and Gauss rules are, and the exponential is exact or a diagonal Pade
+ * approximant, whose logarithm is odd in s. Returns false when the
+ * error has no such expansion.
+ */
+inline
+bool getErrorExpansion(Method outer, Method inner, Method exp, unsigned& order, unsigned& increment)
+{
+    const bool outer_rule = outer == RIEMANN or outer == TRAPEZOID or outer == SIMPSON or outer == BOOLE or
+                            is_gauss(outer);
+    const bool inner_rule = inner == RIEMANN or inner == TRAPEZOID or inner == SIMPSON or is_gauss(inner);
+    const bool exp_series = exp == LINEAR or exp == QUADRATIC or exp == CUBIC or exp == QUARTIC or
+                            exp == QUINTIC or exp == PADE_1_1 or exp == PADE_2_2 or exp == PADE_3_3 or
+                            exp == EXACT;
+    const unsigned o = getOrder(outer), i = getOrder(inner), e = getOrder(exp);
+    if(!outer_rule or !inner_rule or !exp_series or o == 0 or i == 0 or e == 0)
+        return false;
+
+    order = std::min(o, std::min(i, e));
+    const bool symmetric_exp = exp == EXACT or exp == PADE_1_1 or exp == PADE_2_2 or exp == PADE_3_3;
+    increment = outer != RIEMANN and inner != RIEMANN and symmetric_exp ? 2 : 1;
+    return true;
+}
+
+/**
+ * Richardson extrapolation of the results of a sequence of steps halved
+ * from one level to the next (Romberg's tableau). Column j of the tableau
+ * cancels the first j terms of the error expansion, so the last entry of
+ * row k, from the k + 1 levels so far, has the error of order
+ * p + k q.
+ */
+template<typename Real>
+class Romberg
+{
+public:
+    Romberg(unsigned order, unsigned increment) :
+        m_order(order), m_increment(increment)
+    {
+    }
+
+    // Adds the result of the next level and returns the extrapolated value.
+    Real add(Real value)
+    {
+        const size_t k = m_rows.size();
+        m_rows.push_back(std::vector<Real>(k + 1));
+        std::vector<Real>& row = m_rows[k];
+        row[0] = value;
+        for(size_t j = 1; j <= k; ++j)
+        {
+            // 2^(p + (j - 1) q) - 1
+            const Real factor = Real(ldexp(1.0, int(m_order + (j - 1) * m_increment))) - 1;
+            row[j] = row[j-1] + (row[j-1] - m_rows[k-1][j-1]) / factor;
+        }
+        return row[k];
+    }
+
+    // Order of the error of the extrapolated value of level k.
+    unsigned order(size_t k) const
+    {
+        return unsigned(m_order + k * m_increment);
+    }
+
+    const std::vector< std::vector<Real> >& rows() const
+    {
+        return m_rows;
+    }
+
+private:
+    const unsigned m_order;
+    const unsigned m_increment;
+    std::vector< std::vector<Real> > m_rows;
+};
+
+#endif // EXTRAPOLATION_H
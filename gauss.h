@@ -0,0 +1,251 @@
+#ifndef GAUSS_H
+#define GAUSS_H
+
+#include "precision.h"
+
+/**
+ * Gauss-Legendre and Gauss-Kronrod rules on [-1, 1] of any number of points,
+ * with their nodes and weights computed by the compiler: Newton's method on
+ * the Legendre polynomial for the Gauss nodes, bisection on the Stieltjes
+ * polynomial between them for the Kronrod ones. The tables are computed in
+ * long double, or in __float128 for quad, and rounded to Real once.
+ */
+
+// Nodes of the rule in increasing order, their weights, and the weights of
+// the embedded Gauss rule at the same nodes, 0 where it has no node.
+template<typename Real, unsigned N>
+struct GaussTable
+{
+    Real nodes[N];
+    Real weights[N];
+    Real embedded[N];
+};
+
+// Precision the tables are computed in.
+template<typename Real>
+struct GaussPrecision
+{
+    typedef long double type;
+};
+
+#ifdef VRI_QUAD
+template<>
+struct GaussPrecision<__float128>
+{
+    typedef __float128 type;
+};
+#endif
+
+template<typename Real>
+constexpr Real gauss_abs(Real x)
+{
+    return x < 0 ? -x : x;
+}
+
+// P_n(x), and P_n'(x) in derivative for |x| < 1, by the three-term recurrence.
+template<typename Real>
+constexpr Real legendre(unsigned n, Real x, Real *derivative = 0)
+{
+    Real p0 = 1, p1 = x;
+    if(n == 0)
+        p1 = 1;
+    for(unsigned k = 2; k <= n; ++k)
+    {
+        const Real p2 = (Real(2*k - 1) * x * p1 - Real(k - 1) * p0) / Real(k);
+        p0 = p1;
+        p1 = p2;
+    }
+    if(derivative)
+        *derivative = n == 0 ? Real(0) : Real(n) * (x * p1 - p0) / (x * x - 1);
+    return p1;
+}
+
+// cos(x) for x in [0, pi] from its series, for the starting points of Newton.
+template<typename Real>
+constexpr Real gauss_cos(Real x)
+{
+    Real sum = 1, term = 1;
+    for(unsigned k = 1; k < 40; ++k)
+    {
+        term = -term * x * x / Real((2*k - 1) * (2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+template<typename Real, unsigned N>
+constexpr GaussTable<Real, N> gauss_legendre_table()
+{
+    GaussTable<Real, N> table{};
+    const Real pi = 3.14159265358979323846264338327950288L;
+    for(unsigned i = 0; i < N / 2; ++i)
+    {
+        // Newton from the asymptotic estimate, until the step no longer
+        // moves the node.
+        Real x = -gauss_cos(pi * (Real(i) + Real(0.75)) / (Real(N) + Real(0.5)));
+        Real derivative = 0;
+        for(unsigned k = 0; k < 100; ++k)
+        {
+            const Real p = legendre(N, x, &derivative);
+            const Real next = x - p / derivative;
+            if(next == x)
+                break;
+            x = next;
+        }
+        legendre(N, x, &derivative);
+
+        // Symmetric to the last bit.
+        table.nodes[i] = x;
+        table.nodes[N-1 - i] = -x;
+        table.weights[i] = table.weights[N-1 - i] = 2 / ((1 - x * x) * derivative * derivative);
+    }
+    if(N % 2 == 1)
+    {
+        Real derivative = 0;
+        legendre(N, Real(0), &derivative);
+        table.nodes[N / 2] = 0;
+        table.weights[N / 2] = 2 / (derivative * derivative);
+    }
+    return table;
+}
+
+/**
+ * Coefficients c_k of the Stieltjes polynomial E(x) = P_(n+1)(x) + sum c_k
+ * P_k(x), k = n - 1, n - 3, ..., orthogonal to every polynomial of degree n
+ * or less with the weight P_n(x); the Kronrod nodes are its roots. The
+ * conditions on the odd P_j, the even ones hold by parity, form a
+ * triangular system of integrals of three Legendre polynomials, computed
+ * exactly with a Gauss-Legendre rule.
+ */
+template<typename Real, unsigned N>
+constexpr GaussTable<Real, N + 2> stieltjes_coefficients()
+{
+    constexpr unsigned M = (3*N + 3) / 2;
+    const GaussTable<Real, M> rule = gauss_legendre_table<Real, M>();
+
+    // c in nodes, with nodes[n + 1] = 1.
+    GaussTable<Real, N + 2> c{};
+    c.nodes[N + 1] = 1;
+    // Condition j = 2 m + 1 involves P_k for k >= N - j only, solve for
+    // k = N - j from the higher ones.
+    for(unsigned j = 1; j <= N; j += 2)
+    {
+        const unsigned k = N - j;
+        Real a = 0, b = 0;
+        for(unsigned q = 0; q < M; ++q)
+        {
+            const Real x = rule.nodes[q];
+            const Real w = rule.weights[q] * legendre(N, x) * legendre(j, x);
+            a += w * legendre(k, x);
+            for(unsigned l = k + 2; l <= N + 1; l += 2)
+                b += w * c.nodes[l] * legendre(l, x);
+        }
+        c.nodes[k] = -b / a;
+    }
+    return c;
+}
+
+template<typename Real, unsigned N>
+constexpr Real stieltjes(const GaussTable<Real, N + 2>& c, Real x)
+{
+    Real e = 0;
+    for(unsigned k = (N + 1) % 2; k <= N + 1; k += 2)
+        e += c.nodes[k] * legendre(k, x);
+    return e;
+}
+
+/**
+ * The 2 N + 1 point Gauss-Kronrod rule extending the N point Gauss-Legendre
+ * rule. The Kronrod nodes interlace with the Gauss ones, so each lies by
+ * itself between two Gauss nodes, or a Gauss node and an end, where
+ * bisection finds it. The weights are the integrals of the Lagrange
+ * polynomials of the nodes, with a Gauss rule exact for their degree 2 N.
+ */
+template<typename Real, unsigned N>
+constexpr GaussTable<Real, 2*N + 1> gauss_kronrod_table()
+{
+    const GaussTable<Real, N> gauss = gauss_legendre_table<Real, N>();
+    const GaussTable<Real, N + 2> c = stieltjes_coefficients<Real, N>();
+
+    GaussTable<Real, 2*N + 1> table{};
+    for(unsigned i = 0; i <= N / 2; ++i)
+    {
+        Real a = i == 0 ? Real(-1) : gauss.nodes[i-1];
+        Real b = i == N ? Real(1) : gauss.nodes[i];
+        const bool negative = stieltjes<Real, N>(c, a) < 0;
+        for(unsigned k = 0; k < 200; ++k)
+        {
+            const Real m = (a + b) / 2;
+            if(m == a or m == b)
+                break;
+            if((stieltjes<Real, N>(c, m) < 0) == negative)
+                a = m;
+            else
+                b = m;
+        }
+        table.nodes[2*i] = (a + b) / 2;
+        table.nodes[2*N - 2*i] = -table.nodes[2*i];
+    }
+    for(unsigned i = 0; i < N; ++i)
+    {
+        table.nodes[2*i + 1] = gauss.nodes[i];
+        table.embedded[2*i + 1] = gauss.weights[i];
+    }
+    table.nodes[N] = 0;
+
+    const GaussTable<Real, N + 1> rule = gauss_legendre_table<Real, N + 1>();
+    for(unsigned m = 0; m <= N; ++m)
+    {
+        Real w = 0;
+        for(unsigned q = 0; q < N + 1; ++q)
+        {
+            Real l = 1;
+            for(unsigned i = 0; i < 2*N + 1; ++i)
+                if(i != m)
+                    l = l * (rule.nodes[q] - table.nodes[i]) / (table.nodes[m] - table.nodes[i]);
+            w += rule.weights[q] * l;
+        }
+        table.weights[m] = table.weights[2*N - m] = w;
+    }
+    return table;
+}
+
+template<typename Real, typename Work, unsigned N>
+constexpr GaussTable<Real, N> gauss_round(const GaussTable<Work, N>& work)
+{
+    GaussTable<Real, N> table{};
+    for(unsigned i = 0; i < N; ++i)
+    {
+        table.nodes[i] = Real(work.nodes[i]);
+        table.weights[i] = Real(work.weights[i]);
+        table.embedded[i] = Real(work.embedded[i]);
+    }
+    return table;
+}
+
+// The N point Gauss-Legendre rule, exact for polynomials of degree 2 N - 1.
+template<typename Real, unsigned N>
+struct GaussLegendre
+{
+    static constexpr unsigned points = N;
+    static constexpr GaussTable<Real, N> table =
+        gauss_round<Real>(gauss_legendre_table<typename GaussPrecision<Real>::type, N>());
+};
+
+template<typename Real, unsigned N> constexpr unsigned GaussLegendre<Real, N>::points;
+template<typename Real, unsigned N> constexpr GaussTable<Real, N> GaussLegendre<Real, N>::table;
+
+// The 2 N + 1 point Gauss-Kronrod rule, exact for polynomials of degree
+// 3 N + 1, with its N point Gauss rule in embedded.
+template<typename Real, unsigned N>
+struct GaussKronrod
+{
+    static constexpr unsigned points = 2*N + 1;
+    static constexpr GaussTable<Real, 2*N + 1> table =
+        gauss_round<Real>(gauss_kronrod_table<typename GaussPrecision<Real>::type, N>());
+};
+
+template<typename Real, unsigned N> constexpr unsigned GaussKronrod<Real, N>::points;
+template<typename Real, unsigned N> constexpr GaussTable<Real, 2*N + 1> GaussKronrod<Real, N>::table;
+
+#endif // GAUSS_H
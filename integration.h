@@ -1,6 +1,18 @@
 #ifndef INTEGRATION_H
 #define INTEGRATION_H
 
+#include <string>
+#include <vector>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+
+#include "precision.h"
+#include "gauss.h"
+#include "exponential.h"
+
 enum Method
 {
     MONTE_CARLO,
@@ -11,11 +23,20 @@ enum Method
     CUBIC,
     QUARTIC,
     QUINTIC,
+    PADE_1_1,
+    PADE_2_2,
+    PADE_3_3,
     EXACT,
     GAUSS_QUADRATURE,
     GAUSS_QUADRATURE_5,
+    GAUSS_LEGENDRE_8,
+    GAUSS_LEGENDRE_20,
+    GAUSS_KRONROD_15,
+    GAUSS_KRONROD_21,
     SIMPSON,
-    BOOLE
+    BOOLE,
+    ADAPTIVE_RK,
+    PRE_INTEGRATED
 };
 
 inline
@@ -29,22 +50,212 @@ Method getMethod(const std::string &m)
     if(m == "CUBIC")                return CUBIC;
     if(m == "QUARTIC")              return QUARTIC;
     if(m == "QUINTIC")              return QUINTIC;
+    if(m == "PADE_1_1")             return PADE_1_1;
+    if(m == "PADE_2_2")             return PADE_2_2;
+    if(m == "PADE_3_3")             return PADE_3_3;
     if(m == "EXACT")                return EXACT;
     if(m == "GAUSS_QUADRATURE")     return GAUSS_QUADRATURE;
     if(m == "GAUSS_QUADRATURE_5")   return GAUSS_QUADRATURE_5;
+    if(m == "GAUSS_LEGENDRE_8")     return GAUSS_LEGENDRE_8;
+    if(m == "GAUSS_LEGENDRE_20")    return GAUSS_LEGENDRE_20;
+    if(m == "GAUSS_KRONROD_15")     return GAUSS_KRONROD_15;
+    if(m == "GAUSS_KRONROD_21")     return GAUSS_KRONROD_21;
     if(m == "SIMPSON")              return SIMPSON;
     if(m == "BOOLE")                return BOOLE;
+    if(m == "ADAPTIVE_RK")          return ADAPTIVE_RK;
+    if(m == "PRE_INTEGRATED")       return PRE_INTEGRATED;
     assert(0 and "Integration method not found");
     return Method(0);
 }
 
+inline
+const char *getMethodName(Method m)
+{
+    static const char *names[] = {"MONTE_CARLO", "RIEMANN", "TRAPEZOID", "LINEAR", "QUADRATIC", "CUBIC",
+                                  "QUARTIC", "QUINTIC", "PADE_1_1", "PADE_2_2", "PADE_3_3", "EXACT", "GAUSS_QUADRATURE", "GAUSS_QUADRATURE_5",
+                                  "GAUSS_LEGENDRE_8", "GAUSS_LEGENDRE_20", "GAUSS_KRONROD_15", "GAUSS_KRONROD_21",
+                                  "SIMPSON", "BOOLE", "ADAPTIVE_RK", "PRE_INTEGRATED"};
+    return names[m];
+}
+
+/**
+ * Methods of the outer, inner and exponential discretizations, chosen at run
+ * time. outer_dynamic() tests them at every sample.
+ */
+struct DynamicMethods
+{
+    DynamicMethods(Method o, Method i, Method e) : outer(o), inner(i), exp(e)
+    {
+    }
+
+    Method outer;
+    Method inner;
+    Method exp;
+};
+
+/**
+ * Methods fixed at compile time: the tests on them fold away and every
+ * combination gets its own straight-line kernel.
+ */
+template<Method O, Method I, Method E>
+struct StaticMethods
+{
+    static constexpr Method outer = O;
+    static constexpr Method inner = I;
+    static constexpr Method exp = E;
+};
+
+template<Method O, Method I, Method E> constexpr Method StaticMethods<O, I, E>::outer;
+template<Method O, Method I, Method E> constexpr Method StaticMethods<O, I, E>::inner;
+template<Method O, Method I, Method E> constexpr Method StaticMethods<O, I, E>::exp;
+
+/**
+ * Outer method fixed at compile time, inner and exponential methods chosen
+ * at run time: the kernels of the higher-order rules and of the Pade
+ * approximants, whose samples cost more than the tests on the methods.
+ */
+template<Method O>
+struct StaticOuter
+{
+    StaticOuter(Method i, Method e) : inner(i), exp(e)
+    {
+    }
+
+    static constexpr Method outer = O;
+    Method inner;
+    Method exp;
+};
+
+template<Method O> constexpr Method StaticOuter<O>::outer;
+
+/**
+ * Running sum with Neumaier's compensation: the low-order bits each addition
+ * rounds off are gathered in a second term, so the error stays at a few ulps
+ * of the sum instead of growing with the number of terms. Costs three more
+ * additions and a comparison per term.
+ */
+template<typename Real>
+class CompensatedSum
+{
+public:
+    CompensatedSum() : m_sum(0.0), m_compensation(0.0), m_count(0)
+    {
+    }
+
+    inline CompensatedSum& operator+=(Real x)
+    {
+        const Real t = m_sum + x;
+        if(fabs(m_sum) >= fabs(x))
+            m_compensation += (m_sum - t) + x;
+        else
+            m_compensation += (x - t) + m_sum;
+        m_sum = t;
+        ++m_count;
+        return *this;
+    }
+
+    inline Real value() const
+    {
+        return m_sum + m_compensation;
+    }
+
+    // Number of terms added.
+    inline size_t count() const
+    {
+        return m_count;
+    }
+
+private:
+    Real m_sum;
+    Real m_compensation;
+    size_t m_count;
+};
+
+// Whether the method is one of the Gauss-Legendre or Gauss-Kronrod rules.
+inline
+bool is_gauss(Method method)
+{
+    return method == GAUSS_QUADRATURE or method == GAUSS_QUADRATURE_5 or
+           method == GAUSS_LEGENDRE_8 or method == GAUSS_LEGENDRE_20 or
+           method == GAUSS_KRONROD_15 or method == GAUSS_KRONROD_21;
+}
+
+/**
+ * Nodes and weights on [-1, 1] of the rule of a Gauss method, from the
+ * tables of gauss.h. embedded holds the weights of the Gauss rule embedded
+ * in a Gauss-Kronrod rule, and is null for the Gauss-Legendre ones.
+ */
+template<typename Real>
+struct GaussRule
+{
+    template<unsigned N>
+    GaussRule(const GaussTable<Real, N>& table, bool kronrod) :
+        points(N), nodes(table.nodes), weights(table.weights), embedded(kronrod ? table.embedded : 0)
+    {
+    }
+
+    unsigned points;
+    const Real *nodes;
+    const Real *weights;
+    const Real *embedded;
+};
+
+template<typename Real>
+inline
+GaussRule<Real> gauss_rule(Method method)
+{
+    switch(method)
+    {
+    case GAUSS_QUADRATURE:      return GaussRule<Real>(GaussLegendre<Real, 2>::table, false);
+    case GAUSS_QUADRATURE_5:    return GaussRule<Real>(GaussLegendre<Real, 3>::table, false);
+    case GAUSS_LEGENDRE_8:      return GaussRule<Real>(GaussLegendre<Real, 8>::table, false);
+    case GAUSS_LEGENDRE_20:     return GaussRule<Real>(GaussLegendre<Real, 20>::table, false);
+    case GAUSS_KRONROD_15:      return GaussRule<Real>(GaussKronrod<Real, 7>::table, true);
+    case GAUSS_KRONROD_21:      return GaussRule<Real>(GaussKronrod<Real, 10>::table, true);
+    default:
+        assert(0 and "Not a Gauss method");
+        return GaussRule<Real>(GaussLegendre<Real, 2>::table, false);
+    }
+}
+
+// The node x of [-1, 1] mapped to [a, b].
 template<typename Real>
 inline
-const std::vector<Real>& inner(const Solution<Real> &solve,
-                               Real d, unsigned i, Method method,
+Real gauss_node(Real a, Real b, Real x)
+{
+    return 0.5 * (b-a) * x + 0.5 * (a + b);
+}
+
+/**
+ * Integral of f over [a, b] with the Gauss rule. For a Gauss-Kronrod rule,
+ * estimate, when not null, adds |K - G|, the difference from the embedded
+ * Gauss rule: a bound on the error of G, and so, pessimistically, of K.
+ */
+template<typename Real, typename F>
+inline
+Real gauss_panel(const F& f, Real a, Real b, const GaussRule<Real>& rule, Real *estimate = 0)
+{
+    Real int_ab = 0.0, embedded = 0.0;
+    for(unsigned j = 0; j < rule.points; ++j)
+    {
+        const Real y = f(gauss_node(a, b, rule.nodes[j]));
+        int_ab += y * rule.weights[j];
+        if(rule.embedded)
+            embedded += y * rule.embedded[j];
+    }
+    if(estimate and rule.embedded)
+        *estimate += fabs(0.5*(b-a) * (int_ab - embedded));
+    return 0.5*(b-a) * int_ab;
+}
+
+template<typename Real, typename S, typename Methods>
+inline
+const std::vector<Real>& inner(const S &solve,
+                               Real d, unsigned i, const Methods& methods,
                                const std::vector<Real>& pos_array,
-                               std::vector<Real>& integrands)
+                               std::vector<Real>& integrands, Real *estimate = 0)
 {
+    const Method method = methods.inner;
     if(method == MONTE_CARLO)
     {
         size_t j = integrands.size();
@@ -75,33 +286,14 @@ const std::vector<Real>& inner(const Solution<Real> &solve,
             integrands.push_back((solve.T((j-1)*d) + 4.0 * solve.T((j - 0.5)*d) + solve.T((j+0)*d)) * d /6.0);
         }
     }
-    else if(method == GAUSS_QUADRATURE)
-    {
-        static Real P[] = {-1.0 / sqrtl(3.0), +1.0 / sqrtl(3.0)};
-        static Real W[] = {1.0, 1.0};
-
-        if(i >= 1)
-        {
-            Real a = (i-1)*d;
-            Real b = i*d;
-            Real int_ab = 0.0;
-            for(unsigned j = 0; j < 2; ++j) int_ab += solve.T( 0.5 * (b-a) * P[j] + 0.5 * (a + b)) * W[j];
-            integrands.push_back( 0.5*(b-a) * int_ab );
-        }
-
-    }
-    else if(method == GAUSS_QUADRATURE_5)
+    else if(is_gauss(method))
     {
-        static Real P[] = {-sqrtl(15.0) / 5.0, 0.0, +sqrtl(15.0) / 5.0};
-        static Real W[] = {5.0 / 9.0, 8.0 / 9.0, 5.0 / 9.0};
-
         if(i >= 1)
         {
             Real a = (i-1)*d;
             Real b = i*d;
-            Real int_ab = 0.0;
-            for(unsigned j = 0; j < 3; ++j) int_ab += solve.T( 0.5 * (b-a) * P[j] + 0.5 * (a + b)) * W[j];
-            integrands.push_back( 0.5*(b-a) * int_ab );
+            integrands.push_back(gauss_panel([&](Real l) { return solve.T(l); }, a, b,
+                                             gauss_rule<Real>(method), estimate));
         }
     }
     else
@@ -110,101 +302,679 @@ const std::vector<Real>& inner(const Solution<Real> &solve,
     return integrands;
 }
 
-template<typename Real>
+/**
+ * The inner integral over [a, l], the start of the interval of the grid
+ * from a = (i-1) * d, with one panel of the inner method: the optical depth
+ * the outer Gauss rules add to the one at a for their nodes. RIEMANN has no
+ * such panel, its integrands lag one interval behind the grid.
+ */
+template<typename Real, typename S, typename Methods>
 inline
-Real exponential(const std::vector<Real>& integrands, Real& S, Method method)
-{
-    static size_t last_size = 0;
-    if(integrands.size() == 0 or integrands.size() == last_size)
-        return S;
-
-    last_size = integrands.size();
-    const Real s = integrands[last_size-1];
-
-    if (method == LINEAR)
-        S = S * (1);
-    else if (method == QUADRATIC)
-        S = S * (1 - s);
-    else if (method == CUBIC)
-        S = S * (1 - s + 0.5 * s * s);
-    else if (method == QUARTIC)
-        S = S * (1 - s + 0.5 * s * s - (1.0/6.0) * s * s * s);
-    else if (method == QUINTIC)
-        S = S * (1 - s + 0.5 * s * s - (1.0/6.0) * s * s * s + (1.0/24.0) * s * s * s * s);
-    else if (method == EXACT)
-        S = exp(-std::accumulate(integrands.begin(), integrands.end(), Real(0.0)));
-    else
-        assert(0);
+Real inner_panel(const S &solve, Real a, Real l, Real d, const Methods& methods,
+                 const std::vector<Real>& pos_array)
+{
+    const Method method = methods.inner;
+    if(method == MONTE_CARLO)
+    {
+        // The positions inner() adds at the end of the interval.
+        Real tau = 0.0;
+        for(typename std::vector<Real>::const_iterator j = std::upper_bound(pos_array.begin(), pos_array.end(), a);
+            j != pos_array.end() and *j <= l; ++j)
+            tau += d * solve.T(*j);
+        return tau;
+    }
+    else if(method == TRAPEZOID)
+        return (solve.T(a) + solve.T(l)) * (l-a) * 0.5;
+    else if(method == SIMPSON)
+        return (solve.T(a) + 4.0 * solve.T(0.5 * (a + l)) + solve.T(l)) * (l-a) / 6.0;
+    else if(is_gauss(method))
+        return gauss_panel([&](Real x) { return solve.T(x); }, a, l, gauss_rule<Real>(method));
 
-    return S;
+    assert(0);
+    return Real(0.0);
 }
 
-template<typename Real>
-Real outer(const Solution<Real> &solve, Real d, unsigned n, const Method outer_method, const Method inner_method, const Method exp_method,
-           const std::vector<Real>& samples)
+/**
+ * C(i * d) T(i * d) at the grid points, evaluated a chunk of points at a time
+ * through the batch emission of the solution.
+ */
+template<typename Real, typename S>
+class Emission
 {
-    std::vector<Real> integrands;
-    Real alpha = 1.0;
-    Real I = 0.0;
+public:
+    Emission(const S &solve, Real d, unsigned n) :
+        m_solve(solve), m_d(d), m_n(n), m_first(0), m_count(0)
+    {
+    }
 
-    integrands.reserve(n);
-    if (outer_method == RIEMANN)
+    inline Real operator()(unsigned i)
     {
-        for(unsigned i = 1; i < n; ++i)
-            I += solve.C(i * d) * solve.T(i * d) * d * exponential(inner(solve, d, i, inner_method, samples, integrands), alpha, exp_method);
+        if(i < m_first or i >= m_first + m_count)
+            fill(i);
+        return m_values[i - m_first];
     }
-    else if(outer_method == TRAPEZOID)
+
+private:
+    // Small enough that early terminated rays waste little.
+    enum { CHUNK = 32 };
+
+    void fill(unsigned i)
     {
-        Real A, B;
-        A = solve.C(0 * d) * solve.T(0 * d) * exponential(inner(solve, d, 0, inner_method, samples, integrands), alpha, exp_method);
-        for(unsigned i = 1; i < n; ++i)
-        {
-            B = solve.C(i*d) * solve.T(i*d) * exponential(inner(solve, d, i, inner_method, samples, integrands), alpha, exp_method);
-            I += (A+B) * d * 0.5;
-            A = B;
-        }
+        m_first = i;
+        m_count = std::min(unsigned(CHUNK), m_n - i);
+        for(unsigned k = 0; k < m_count; ++k)
+            m_l[k] = (i + k) * m_d;
+        m_solve.emission(m_l, m_values, m_count);
     }
-    else if(outer_method == SIMPSON)
+
+    const S &m_solve;
+    const Real m_d;
+    const unsigned m_n;
+    unsigned m_first;
+    unsigned m_count;
+    Real m_l[CHUNK];
+    Real m_values[CHUNK];
+};
+
+template<typename Real, typename S>
+class OuterKernels;
+
+/**
+ * Whether the solution type S is integrated with the MONTE_CARLO inner
+ * method. Solutions that never are specialize it to false, and OuterKernels
+ * leaves those kernels out.
+ */
+template<typename S>
+struct MonteCarloKernels
+{
+    enum { value = true };
+};
+
+/**
+ * Integrates the emission along rays with the outer, inner and exponential
+ * methods. Holds the state of the integration in progress: the integrands of
+ * the inner integral, the transmittance and the optical depth. Every outer()
+ * starts from a clean state and keeps the capacity of the integrand buffer,
+ * so one instance integrates ray after ray without allocating. Instances
+ * share nothing, threads integrate in parallel with one instance each.
+ */
+template<typename Real>
+class Integrator
+{
+public:
+    Integrator() : m_alpha(1.0), m_last_size(0), m_outer_estimate(0.0), m_inner_estimate(0.0)
     {
-        Real fa, fm, fb;
-        unsigned a, b, c;
+    }
 
-        a = 0;
-        fa = solve.C(a * d) * solve.T(a * d) * exponential(inner(solve, d, a, inner_method, samples, integrands), alpha, exp_method);
-        for(unsigned i = 2; i < n; i += 2)
+    /**
+     * Integrates the emission over the n grid points l = i * d with the
+     * kernel specialized for the methods, chosen once per call. With a
+     * threshold, the integration stops at the end of the first stencil where
+     * the transmittance drops below it: the rest of the ray can add at most
+     * the transmittance times its largest emission. A threshold of 0
+     * integrates the whole ray. reached receives the last grid point
+     * integrated, n - 1 when the integration ran to the end.
+     */
+    template<typename S>
+    Real outer(const S &solve, Real d, unsigned n, const Method outer_method, const Method inner_method, const Method exp_method,
+               const std::vector<Real>& samples, Real threshold = 0.0, Real *transmittance = 0, unsigned *reached = 0)
+    {
+        static const OuterKernels<Real, S> kernels;
+        const typename OuterKernels<Real, S>::Kernel kernel = kernels.find(outer_method, inner_method, exp_method);
+        if(!kernel)
         {
-            b = i-1;
-            c = i-0;
-            fm = solve.C(b * d) * solve.T(b * d) * exponential(inner(solve, d, b, inner_method, samples, integrands), alpha, exp_method);
-            fb = solve.C(c * d) * solve.T(c * d) * exponential(inner(solve, d, c, inner_method, samples, integrands), alpha, exp_method);
-            I += fa + 4.0 * fm + fb;
-            fa = fb;
+            assert(0 and "Integration method combination not supported");
+            return Real(0.0);
         }
-        I *= (2.0 * d) / 6.0;
+        return kernel(*this, solve, d, n, DynamicMethods(outer_method, inner_method, exp_method),
+                      samples, threshold, transmittance, reached);
+    }
+
+    /**
+     * outer() testing the methods at every sample instead, the baseline of
+     * benchmark_dispatch().
+     */
+    template<typename S>
+    Real outer_dynamic(const S &solve, Real d, unsigned n, const Method outer_method, const Method inner_method, const Method exp_method,
+                       const std::vector<Real>& samples, Real threshold = 0.0, Real *transmittance = 0, unsigned *reached = 0)
+    {
+        return kernel(solve, d, n, DynamicMethods(outer_method, inner_method, exp_method),
+                      samples, threshold, transmittance, reached);
     }
-    else if(outer_method == BOOLE)
+
+    // outer() with the methods of Methods.
+    template<typename S, typename Methods>
+    Real kernel(const S &solve, Real d, unsigned n, const Methods& methods,
+                const std::vector<Real>& samples, Real threshold, Real *transmittance, unsigned *reached)
     {
-        static const Real W[] = {7.0, 32.0, 12.0, 32.0, 7.0};
-        Real f[5];
+        const Method outer_method = methods.outer;
+        Emission<Real, S> emission(solve, d, n);
+        CompensatedSum<Real> I;
+        Real scale = 1.0;
+        unsigned last = n - 1;
 
-        f[0] = solve.C(0 * d) * solve.T(0 * d) * exponential(inner(solve, d, 0, inner_method, samples, integrands), alpha, exp_method);
-        for(unsigned i = 4; i < n; i += 4)
+        reset(n);
+        if (outer_method == RIEMANN)
+        {
+            for(unsigned i = 1; i < n; ++i)
+            {
+                I += emission(i) * d * attenuation(solve, d, i, methods, samples);
+                if(threshold > 0.0 and m_alpha < threshold)
+                {
+                    last = i;
+                    break;
+                }
+            }
+        }
+        else if(outer_method == TRAPEZOID)
         {
-            for(int k = 3; k >= 0; --k)
+            Real A, B;
+            A = emission(0) * attenuation(solve, d, 0, methods, samples);
+            for(unsigned i = 1; i < n; ++i)
             {
-                unsigned l = i-k;
-                f[4-k] = solve.C(l * d) * solve.T(l * d) * exponential(inner(solve, d, l, inner_method, samples, integrands), alpha, exp_method);
+                B = emission(i) * attenuation(solve, d, i, methods, samples);
+                I += (A+B) * d * 0.5;
+                A = B;
+                if(threshold > 0.0 and m_alpha < threshold)
+                {
+                    last = i;
+                    break;
+                }
             }
+        }
+        else if(outer_method == SIMPSON)
+        {
+            Real fa, fm, fb;
+            unsigned a, b, c;
+
+            a = 0;
+            fa = emission(a) * attenuation(solve, d, a, methods, samples);
+            for(unsigned i = 2; i < n; i += 2)
+            {
+                b = i-1;
+                c = i-0;
+                fm = emission(b) * attenuation(solve, d, b, methods, samples);
+                fb = emission(c) * attenuation(solve, d, c, methods, samples);
+                I += fa + 4.0 * fm + fb;
+                fa = fb;
+                // Only whole panels, the stencil needs both of its intervals.
+                if(threshold > 0.0 and m_alpha < threshold)
+                {
+                    last = c;
+                    break;
+                }
+            }
+            scale = (2.0 * d) / 6.0;
+        }
+        else if(outer_method == BOOLE)
+        {
+            static const Real W[] = {7.0, 32.0, 12.0, 32.0, 7.0};
+            Real f[5];
 
-            for(unsigned k = 0; k < 5; ++k)
-                I += W[k] * f[k];
+            f[0] = emission(0) * attenuation(solve, d, 0, methods, samples);
+            for(unsigned i = 4; i < n; i += 4)
+            {
+                for(int k = 3; k >= 0; --k)
+                {
+                    unsigned l = i-k;
+                    f[4-k] = emission(l) * attenuation(solve, d, l, methods, samples);
+                }
+
+                for(unsigned k = 0; k < 5; ++k)
+                    I += W[k] * f[k];
 
-            f[0] = f[4];
+                f[0] = f[4];
+                if(threshold > 0.0 and m_alpha < threshold)
+                {
+                    last = i;
+                    break;
+                }
+            }
+            scale = (2.0 * d) / 45.0;
+        }
+        else if(is_gauss(outer_method))
+        {
+            // Every interval with the Gauss rule. The transmittance at a node
+            // is the one at the start of the interval times the decay of the
+            // optical depth since, one panel of the inner method.
+            const GaussRule<Real> rule = gauss_rule<Real>(outer_method);
+            Real alpha = attenuation(solve, d, 0, methods, samples);
+            for(unsigned i = 1; i < n; ++i)
+            {
+                const Real a = (i-1)*d;
+                I += gauss_panel([&](Real l)
+                                 {
+                                     return solve.C(l) * solve.T(l) * alpha *
+                                            decay(methods, inner_panel(solve, a, l, d, methods, samples));
+                                 }, a, Real(i*d), rule, &m_outer_estimate);
+                alpha = attenuation(solve, d, i, methods, samples);
+                if(threshold > 0.0 and m_alpha < threshold)
+                {
+                    last = i;
+                    break;
+                }
+            }
         }
-        I *= (2.0 * d) / 45.0;
+        else
+            assert(0);
+
+        // Transmittance accumulated along the segment, to composite it with
+        // the segments behind.
+        if(transmittance)
+            *transmittance = m_alpha;
+        if(reached)
+            *reached = last;
+
+        return I.value() * scale;
     }
-    else
+
+    /**
+     * Error estimates of the last integration with the Gauss-Kronrod rules:
+     * the sums over the intervals of |K - G| of the emission for an outer
+     * GAUSS_KRONROD method, and of the optical depth for an inner one. 0 for
+     * the other methods.
+     */
+    Real outer_estimate() const
+    {
+        return m_outer_estimate;
+    }
+    Real inner_estimate() const
+    {
+        return m_inner_estimate;
+    }
+
+private:
+    void reset(unsigned n)
+    {
+        m_integrands.clear();
+        m_integrands.reserve(n);
+        m_tau = CompensatedSum<Real>();
+        m_alpha = 1.0;
+        m_last_size = 0;
+        m_outer_estimate = 0.0;
+        m_inner_estimate = 0.0;
+    }
+
+    // Transmittance up to grid point i, after the inner integral up to i.
+    template<typename S, typename Methods>
+    inline Real attenuation(const S &solve, Real d, unsigned i, const Methods& methods,
+                            const std::vector<Real>& samples)
+    {
+        inner(solve, d, i, methods, samples, m_integrands, &m_inner_estimate);
+        return exponential(methods);
+    }
+
+    // exp(-s), or its approximation by the exponential method: LINEAR to
+    // QUINTIC truncate its series after 1 to 5 terms.
+    template<typename Methods>
+    static inline Real decay(const Methods& methods, Real s)
+    {
+        const Method method = methods.exp;
+        if (method == LINEAR)
+            return Taylor<0>::evaluate(s);
+        else if (method == QUADRATIC)
+            return Taylor<1>::evaluate(s);
+        else if (method == CUBIC)
+            return Taylor<2>::evaluate(s);
+        else if (method == QUARTIC)
+            return Taylor<3>::evaluate(s);
+        else if (method == QUINTIC)
+            return Taylor<4>::evaluate(s);
+        else if (method == PADE_1_1)
+            return Pade<1, 1>::evaluate(s);
+        else if (method == PADE_2_2)
+            return Pade<2, 2>::evaluate(s);
+        else if (method == PADE_3_3)
+            return Pade<3, 3>::evaluate(s);
+        else if (method == EXACT)
+            return exp(-s);
+
+        assert(0);
+        return 1;
+    }
+
+    /**
+     * Updates the transmittance with the integrands inner() added since the
+     * last call. EXACT keeps the optical depth of the integrands in m_tau,
+     * adding each one once, the other methods multiply the transmittance by
+     * the approximation of exp(-s) of each new one, evaluated all at once by
+     * attenuate() when MONTE_CARLO added several.
+     */
+    template<typename Methods>
+    inline Real exponential(const Methods& methods)
+    {
+        const Method method = methods.exp;
+        if(m_integrands.size() == 0 or m_integrands.size() == m_last_size)
+            return m_alpha;
+
+        // MONTE_CARLO can add several integrands at once.
+        const size_t first = m_last_size;
+        m_last_size = m_integrands.size();
+
+        if (method == EXACT)
+        {
+            for(size_t k = m_tau.count(); k < m_integrands.size(); ++k)
+                m_tau += m_integrands[k];
+            m_alpha = exp(-m_tau.value());
+        }
+        else if(m_last_size - first == 1)
+            m_alpha = m_alpha * decay(methods, m_integrands[first]);
+        else
+            m_alpha = attenuate(methods, first);
+
+        return m_alpha;
+    }
+
+    // The transmittance after the integrands from first on, with attenuate()
+    // and the approximation of the exponential method.
+    template<typename Methods>
+    inline Real attenuate(const Methods& methods, size_t first)
+    {
+        const Method method = methods.exp;
+        const size_t count = m_integrands.size() - first;
+        m_decays.resize(count);
+        const Real *s = &m_integrands[first];
+        Real *values = &m_decays[0];
+        if (method == LINEAR)
+            return ::attenuate< Taylor<0> >(m_alpha, s, values, count);
+        else if (method == QUADRATIC)
+            return ::attenuate< Taylor<1> >(m_alpha, s, values, count);
+        else if (method == CUBIC)
+            return ::attenuate< Taylor<2> >(m_alpha, s, values, count);
+        else if (method == QUARTIC)
+            return ::attenuate< Taylor<3> >(m_alpha, s, values, count);
+        else if (method == QUINTIC)
+            return ::attenuate< Taylor<4> >(m_alpha, s, values, count);
+        else if (method == PADE_1_1)
+            return ::attenuate< Pade<1, 1> >(m_alpha, s, values, count);
+        else if (method == PADE_2_2)
+            return ::attenuate< Pade<2, 2> >(m_alpha, s, values, count);
+        else if (method == PADE_3_3)
+            return ::attenuate< Pade<3, 3> >(m_alpha, s, values, count);
+
         assert(0);
+        return m_alpha;
+    }
+
+    std::vector<Real> m_integrands;
+    // The approximations of exp(-s) of the integrands attenuate() last saw.
+    std::vector<Real> m_decays;
+    CompensatedSum<Real> m_tau;
+    Real m_alpha;
+    // Number of integrands exponential() last saw.
+    size_t m_last_size;
+    Real m_outer_estimate;
+    Real m_inner_estimate;
+};
+
+template<typename Real, typename S, Method O, Method I, Method E>
+Real outer_static(Integrator<Real>& integrator, const S &solve, Real d, unsigned n, const DynamicMethods&,
+                  const std::vector<Real>& samples, Real threshold, Real *transmittance, unsigned *reached)
+{
+    return integrator.kernel(solve, d, n, StaticMethods<O, I, E>(), samples, threshold, transmittance, reached);
+}
+
+template<typename Real, typename S, Method O>
+Real outer_static_outer(Integrator<Real>& integrator, const S &solve, Real d, unsigned n, const DynamicMethods& methods,
+                        const std::vector<Real>& samples, Real threshold, Real *transmittance, unsigned *reached)
+{
+    return integrator.kernel(solve, d, n, StaticOuter<O>(methods.inner, methods.exp),
+                             samples, threshold, transmittance, reached);
+}
+
+/**
+ * Integrator::kernel() for every combination of the outer, inner and
+ * exponential methods it supports, for the solution type S. The classic
+ * outer rules get a kernel specialized for each of their combinations with
+ * the inner rules up to GAUSS_QUADRATURE_5 and the Taylor exponentials;
+ * every other combination shares the kernel of its outer method. The outer
+ * Gauss rules only come with the EXACT exponential, the approximations
+ * would cap their order, and without RIEMANN, which has no panel for
+ * inner_panel().
+ */
+template<typename Real, typename S>
+class OuterKernels
+{
+public:
+    typedef Real (*Kernel)(Integrator<Real>&, const S&, Real, unsigned, const DynamicMethods&,
+                           const std::vector<Real>&, Real, Real*, unsigned*);
+
+    OuterKernels() : m_kernels()
+    {
+        fill_outer<RIEMANN>(0);
+        fill_outer<TRAPEZOID>(1);
+        fill_outer<SIMPSON>(2);
+        fill_outer<BOOLE>(3);
+        fill_shared<GAUSS_QUADRATURE>(4);
+        fill_shared<GAUSS_QUADRATURE_5>(5);
+        fill_shared<GAUSS_LEGENDRE_8>(6);
+        fill_shared<GAUSS_LEGENDRE_20>(7);
+        fill_shared<GAUSS_KRONROD_15>(8);
+        fill_shared<GAUSS_KRONROD_21>(9);
+    }
+
+    // Null for the combinations Integrator::kernel() does not support.
+    Kernel find(Method o, Method i, Method e) const
+    {
+        if(!supports(o, i, e))
+            return 0;
+        return m_kernels[index(OUTER, 10, o)][index(INNER, 10, i)][index(EXP, 9, e)];
+    }
+
+    // Whether find() has a kernel for the combination, without building
+    // the table.
+    static bool supports(Method o, Method i, Method e)
+    {
+        if(index(OUTER, 10, o) < 0 or index(INNER, 10, i) < 0 or index(EXP, 9, e) < 0)
+            return false;
+        if(i == MONTE_CARLO and !MonteCarloKernels<S>::value)
+            return false;
+        return !is_gauss(o) or (i != RIEMANN and e == EXACT);
+    }
+
+    static constexpr Method OUTER[10] = {RIEMANN, TRAPEZOID, SIMPSON, BOOLE,
+                                         GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, GAUSS_LEGENDRE_8,
+                                         GAUSS_LEGENDRE_20, GAUSS_KRONROD_15, GAUSS_KRONROD_21};
+    static constexpr Method INNER[10] = {MONTE_CARLO, RIEMANN, TRAPEZOID, SIMPSON,
+                                         GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, GAUSS_LEGENDRE_8,
+                                         GAUSS_LEGENDRE_20, GAUSS_KRONROD_15, GAUSS_KRONROD_21};
+    static constexpr Method EXP[9] = {LINEAR, QUADRATIC, CUBIC, QUARTIC, QUINTIC,
+                                      PADE_1_1, PADE_2_2, PADE_3_3, EXACT};
+
+private:
+    static int index(const Method *methods, int count, Method m)
+    {
+        for(int k = 0; k < count; ++k)
+            if(methods[k] == m)
+                return k;
+        return -1;
+    }
+
+    template<Method O>
+    void fill_outer(unsigned o)
+    {
+        fill_shared<O>(o);
+        fill_monte_carlo<O>(o, std::integral_constant<bool, MonteCarloKernels<S>::value>());
+        fill_exp<O, RIEMANN>(o, 1);
+        fill_exp<O, TRAPEZOID>(o, 2);
+        fill_exp<O, SIMPSON>(o, 3);
+        fill_exp<O, GAUSS_QUADRATURE>(o, 4);
+        fill_exp<O, GAUSS_QUADRATURE_5>(o, 5);
+    }
+
+    template<Method O>
+    void fill_monte_carlo(unsigned o, std::true_type)
+    {
+        fill_exp<O, MONTE_CARLO>(o, 0);
+    }
+
+    template<Method O>
+    void fill_monte_carlo(unsigned, std::false_type)
+    {
+    }
+
+    template<Method O, Method I>
+    void fill_exp(unsigned o, unsigned i)
+    {
+        m_kernels[o][i][0] = &outer_static<Real, S, O, I, LINEAR>;
+        m_kernels[o][i][1] = &outer_static<Real, S, O, I, QUADRATIC>;
+        m_kernels[o][i][2] = &outer_static<Real, S, O, I, CUBIC>;
+        m_kernels[o][i][3] = &outer_static<Real, S, O, I, QUARTIC>;
+        m_kernels[o][i][4] = &outer_static<Real, S, O, I, QUINTIC>;
+        m_kernels[o][i][8] = &outer_static<Real, S, O, I, EXACT>;
+    }
+
+    // The kernel of the outer method O for all its supported combinations.
+    template<Method O>
+    void fill_shared(unsigned o)
+    {
+        for(unsigned i = 0; i < 10; ++i)
+            for(unsigned e = 0; e < 9; ++e)
+                if(supports(O, INNER[i], EXP[e]))
+                    m_kernels[o][i][e] = &outer_static_outer<Real, S, O>;
+    }
+
+    Kernel m_kernels[10][10][9];
+};
+
+template<typename Real, typename S> constexpr Method OuterKernels<Real, S>::OUTER[10];
+template<typename Real, typename S> constexpr Method OuterKernels<Real, S>::INNER[10];
+template<typename Real, typename S> constexpr Method OuterKernels<Real, S>::EXP[9];
+
+/**
+ * Integrates the emission over l in [0, length] as the ODE system
+ *
+ *     dI/dl = C(l) T(l) exp(-tau),    dtau/dl = T(l)
+ *
+ * with the Dormand-Prince 5(4) embedded pair, starting with step h. Steps
+ * are accepted when the difference between the two solutions is below
+ * tolerance * (1 + |y|) for both I and tau, and resized from the error
+ * estimate, so smooth stretches take large steps. No step is longer than
+ * h_max: the error estimate only sees the features the stages land on.
+ * Steps starting in one of the ranges of uniform, sorted ranges of l where
+ * C and T are known to have no features, may run up to its end instead. The
+ * inner and exponential methods do not apply: tau is integrated along with
+ * I.
+ *
+ * threshold, transmittance and reached work as for Integrator::outer();
+ * reached is the parameter where the integration stopped. evaluations
+ * receives the number of evaluations of C and T.
+ */
+template<typename Real, typename S>
+Real outer_adaptive(const S &solve, Real length, Real h, Real h_max, Real tolerance,
+                    Real threshold = 0.0, Real *transmittance = 0, Real *reached = 0,
+                    size_t *evaluations = 0, const std::vector< std::pair<Real, Real> > *uniform = 0)
+{
+    static const Real c[7] = {0.0, 1.0/5.0, 3.0/10.0, 4.0/5.0, 8.0/9.0, 1.0, 1.0};
+    static const Real a[7][6] =
+    {
+        {0.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+        {1.0/5.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+        {3.0/40.0, 9.0/40.0, 0.0, 0.0, 0.0, 0.0},
+        {44.0/45.0, -56.0/15.0, 32.0/9.0, 0.0, 0.0, 0.0},
+        {19372.0/6561.0, -25360.0/2187.0, 64448.0/6561.0, -212.0/729.0, 0.0, 0.0},
+        {9017.0/3168.0, -355.0/33.0, 46732.0/5247.0, 49.0/176.0, -5103.0/18656.0, 0.0},
+        {35.0/384.0, 0.0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0}
+    };
+    // Difference between the 5th order weights (the last row of a) and the
+    // embedded 4th order ones.
+    static const Real e[7] = {71.0/57600.0, 0.0, -71.0/16695.0, 71.0/1920.0,
+                              -17253.0/339200.0, 22.0/525.0, -1.0/40.0};
+    // Steps shorter than this are accepted whatever their error, so that a
+    // discontinuity in the transfer functions cannot stall the ray.
+    const Real h_min = length * 1e-6;
+
+    size_t count = 0;
+    // C T and T at l + c[s] * h for each stage s.
+    Real CT[7], TT[7];
+    auto stage = [&](Real l, unsigned s)
+    {
+        const Real t = solve.T(l);
+        CT[s] = solve.C(l) * t;
+        TT[s] = t;
+        ++count;
+    };
+
+    // I and tau add one step at a time, compensated so that the error
+    // floor does not rise with the number of steps.
+    Real l = 0.0, I = 0.0, tau = 0.0;
+    CompensatedSum<Real> I_sum, tau_sum;
+    h_max = std::min(std::max(h_max, h_min), length);
+
+    // Longest step from l; l only grows, the ranges behind it are dropped.
+    size_t range = 0;
+    auto longest = [&](Real at)
+    {
+        if(!uniform)
+            return h_max;
+        while(range < uniform->size() and (*uniform)[range].second <= at)
+            ++range;
+        if(range < uniform->size() and (*uniform)[range].first <= at)
+            return std::max(h_max, (*uniform)[range].second - at);
+        return h_max;
+    };
+
+    h = std::min(std::max(h, h_min), longest(l));
+    stage(l, 0);
+    while(l < length)
+    {
+        if(l + h > length)
+            h = length - l;
+
+        // The emission of stage s decays with the optical depth reached by
+        // the stage; tau does not depend on I.
+        Real kI[7], kt[7];
+        kI[0] = CT[0] * exp(-tau);
+        kt[0] = TT[0];
+        for(unsigned s = 1; s < 7; ++s)
+        {
+            Real dtau = 0.0;
+            for(unsigned j = 0; j < s; ++j)
+                dtau += a[s][j] * kt[j];
+            stage(l + c[s] * h, s);
+            kI[s] = CT[s] * exp(-(tau + h * dtau));
+            kt[s] = TT[s];
+        }
+
+        Real dI = 0.0, dtau = 0.0, eI = 0.0, etau = 0.0;
+        for(unsigned s = 0; s < 6; ++s)
+        {
+            dI   += a[6][s] * kI[s];
+            dtau += a[6][s] * kt[s];
+        }
+        for(unsigned s = 0; s < 7; ++s)
+        {
+            eI   += e[s] * kI[s];
+            etau += e[s] * kt[s];
+        }
+
+        const Real error = std::max(fabs(h * eI)   / (tolerance * (1.0 + fabs(I + h * dI))),
+                                    fabs(h * etau) / (tolerance * (1.0 + fabs(tau + h * dtau))));
+        if(error <= 1.0 or h <= h_min)
+        {
+            l += h;
+            I_sum += h * dI;
+            tau_sum += h * dtau;
+            I = I_sum.value();
+            tau = tau_sum.value();
+            // The last stage is at the end of the step: first same as last.
+            CT[0] = CT[6];
+            TT[0] = TT[6];
+
+            if(threshold > 0.0 and exp(-tau) < threshold)
+                break;
+        }
+
+        const Real factor = error > 0.0 ? Real(0.9) * pow(error, Real(-0.2)) : Real(5.0);
+        h = std::min(longest(l), std::max(h_min, h * std::min(Real(5.0), std::max(Real(0.2), factor))));
+    }
+
+    if(transmittance)
+        *transmittance = exp(-tau);
+    if(reached)
+        *reached = std::min(l, length);
+    if(evaluations)
+        *evaluations = count;
 
     return I;
 }
@@ -3,14 +3,20 @@
 
 #include <teem/nrrd.h>
 #include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
 
 #include "GageAdaptor.h"
+#include "StreamingAdaptor.h"
+#include "transfer_function.h"
 
 /**
+Sets the kernels and queries used by the renderer.
 */
-boost::shared_ptr<CGageAdaptor> LoadImage(const std::string& imageFileName)
+void SetDefaultKernels(CGageAdaptor& image)
 {
-    boost::shared_ptr<CGageAdaptor> m_image;
     double kernelParam[3];
 
     // Scale parameter, in units of samples.
@@ -24,38 +30,146 @@ boost::shared_ptr<CGageAdaptor> LoadImage(const std::string& imageFileName)
     kernelParam[1] = 0.0;
     kernelParam[2] = 0.5;
 
+    // BC family of cubic polynomial splines.
+    if (!image.SetValueKernel(nrrdKernelBCCubic, kernelParam))
+    {
+        std::cerr << "set value kernel failed..." << std::endl;
+    }
+
+    // 1st deriv. of BC cubic family.
+    if (!image.Set1stDerivativeKernel(nrrdKernelBCCubicD, kernelParam))
+    {
+        std::cerr << "set derivative kernel failed..." << std::endl;
+    }
+
+    if (!image.EnableQuery(CGageAdaptor::NORMAL))
+    {
+        std::cerr << "enable query failed..." << std::endl;
+    }
+}
+
+/**
+Opens a scalar volume for probing. When mapped is true, raw encoded volumes
+are mapped read-only instead of being read into memory.
+*/
+boost::shared_ptr<CGageAdaptor> LoadImage(const std::string& imageFileName, bool mapped = true)
+{
+    boost::shared_ptr<CGageAdaptor> m_image;
+
     m_image.reset(new CGageAdaptor);
 
     if (!m_image.get())
     {
         std::cerr << "get image failed..." << std::endl;
-        return false;
+        return boost::shared_ptr<CGageAdaptor>();
+    }
+
+    if (!(mapped ? m_image->OpenMapped(imageFileName) : m_image->Open(imageFileName)))
+    {
+        std::cerr << "open image failed..." << std::endl;
+        return boost::shared_ptr<CGageAdaptor>();
     }
 
-    if (!m_image->Open(imageFileName))
+    SetDefaultKernels(*m_image);
+
+    return m_image;
+}
+
+/**
+Splits a scalar volume into the bricks of a brick file. The volume is mapped
+when possible, so it does not need to fit in memory.
+*/
+bool CreateBrickFile(const std::string& imageFileName, const std::string& brickFileName, unsigned int brickSize)
+{
+    CGageAdaptor image;
+
+    if (!image.OpenMapped(imageFileName))
     {
         std::cerr << "open image failed..." << std::endl;
         return false;
     }
 
-    // BC family of cubic polynomial splines.
-    if (!m_image->SetValueKernel(nrrdKernelBCCubic, kernelParam))
+    return CBrickCache::Create(image, brickFileName, brickSize);
+}
+
+/**
+Opens a brick file for streaming, keeping at most cacheSize bytes of bricks in
+memory.
+*/
+boost::shared_ptr<CStreamingAdaptor> LoadStreamingImage(const std::string& brickFileName, size_t cacheSize)
+{
+    boost::shared_ptr<CStreamingAdaptor> m_image(new CStreamingAdaptor);
+
+    if (!m_image->Open(brickFileName, cacheSize))
     {
-        std::cerr << "set value kernel failed..." << std::endl;
+        std::cerr << "open brick file failed..." << std::endl;
+        return boost::shared_ptr<CStreamingAdaptor>();
     }
 
-    // 1st deriv. of BC cubic family.
-    if (!m_image->Set1stDerivativeKernel(nrrdKernelBCCubicD, kernelParam))
+    SetDefaultKernels(*m_image);
+
+    return m_image;
+}
+
+/**
+Loads a 1D transfer function. The table runs along the last axis of the nrrd;
+if the nrrd has more than one component per entry, only the first one is
+used. The domain is taken from the axis min/max when present and defaults to
+[0, N-1] otherwise.
+*/
+template<typename Real>
+bool LoadTransferFunction(const std::string& fileName, TransferFunction<Real>& tf)
+{
+    Nrrd *nin = nrrdNew();
+
+    if (nrrdLoad(nin, fileName.c_str(), NULL))
     {
-        std::cerr << "set derivative kernel failed..." << std::endl;
+        char *err = biffGetDone(NRRD);
+        std::cerr << "open transfer function failed: " << err << std::endl;
+        free(err);
+        nrrdNuke(nin);
+        return false;
     }
 
-    if (!m_image->EnableQuery(CGageAdaptor::NORMAL))
+    const unsigned last = nin->dim - 1;
+    const size_t n = nin->axis[last].size;
+    const size_t stride = nrrdElementNumber(nin) / n;
+
+    tf.m_table.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        tf.m_table[i] = nrrdDLookup[nin->type](nin->data, i * stride);
+
+    tf.m_min = std::isfinite(nin->axis[last].min) ? nin->axis[last].min : 0.0;
+    tf.m_max = std::isfinite(nin->axis[last].max) ? nin->axis[last].max : n - 1.0;
+
+    nrrdNuke(nin);
+
+    return true;
+}
+
+/**
+Saves a row-major width x height float image. The format is chosen by teem
+from the file extension.
+*/
+inline
+bool SaveImage(const std::string& fileName, std::vector<float>& pixels,
+               unsigned width, unsigned height)
+{
+    Nrrd *nout = nrrdNew();
+
+    if (nrrdWrap_va(nout, &pixels[0], nrrdTypeFloat, 2, size_t(width), size_t(height))
+        || nrrdSave(fileName.c_str(), nout, NULL))
     {
-        std::cerr << "enable query failed..." << std::endl;
+        char *err = biffGetDone(NRRD);
+        std::cerr << "save image failed: " << err << std::endl;
+        free(err);
+        nrrdNix(nout);
+        return false;
     }
 
-    return m_image;
+    nrrdNix(nout);
+
+    return true;
 }
 
 //Nrrd* open(char *filename)
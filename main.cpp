@@ -1,8 +1,12 @@
 #include <iostream>
+#include <fstream>
 #include <cassert>
 #include <algorithm>
 #include <iomanip>
+#include <thread>
+#include <chrono>
 #include <tr1/random>
+#include <sys/resource.h>
 #include <boost/program_options.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -10,43 +14,339 @@
 #include "solutions.h"
 #include "integration.h"
 #include "pre_integration.h"
+#include "render.h"
+#include "benchmark.h"
+#include "sweep.h"
+#include "extrapolation.h"
 
-typedef long double Real;
 std::tr1::random_device rd;
-std::tr1::subtract_with_carry_01<Real, 48, 10, 24> gen(rd());
+std::tr1::subtract_with_carry_01<double, 48, 10, 24> gen(rd());
 
 namespace po = boost::program_options;
 
-int main(int argc, const char *argv[])
+// Accuracy and speed of the convergence check at one precision.
+struct PrecisionReport
+{
+    const char *name;
+    double error;
+    double seconds;
+    size_t points;
+};
+
+/**
+ * Renders --input with the integrators instantiated for Real.
+ */
+template<typename Real>
+int render_volume(const po::variables_map& vm, Real d)
 {
+    const std::string layout = vm["layout"].as<std::string>();
+    if(layout != "linear" and layout != "bricked")
+    {
+        std::cerr << "unknown layout " << layout << std::endl;
+        return 1;
+    }
 
-    po::options_description desc("Allowed options");
-    desc.add_options()
-        ("help", "produce help message")
-        ("start", po::value< std::string >()->default_value("0 0 0"), "ray starting point")
-        ("end", po::value< std::string >()->default_value("1 0 0"), "ray ending point")
-        ("inner", po::value< std::string>()->default_value("RIEMANN"), "inner integral numerical integration method: RIEMANN, MONTE_CARLO, TRAPEZOID, GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, SIMPSON, BOOLE")
-        ("outer", po::value< std::string>()->default_value("RIEMANN"), "outer integral numerical integration method: RIEMANN, MONTE_CARLO, TRAPEZOID, GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, SIMPSON, BOOLE")
-        ("exp", po::value< std::string>()->default_value("QUADRATIC"), "exponential approximation method: LINEAR, QUADRATIC, CUBIC, QUARTIC, QUINTIC, EXACT")
-        ("step-size", po::value< float >()->default_value(0.125E+0), "step size along the parameterized ray. The ray is parameterized by as X = start + delta * (end - start), where delta is the step size")
-        ("input", po::value< std::string >(), "input nrrd scalar field")
-        ("color", po::value< std::string >(), "input nrrd color transfer function")
-        ("transparency", po::value< std::string >(), "input nrrd extinction coefficient")
-        ("check-convergence", "check the method convergence. If an analytical solution is specified, then the solution is used. Otherwise, the convergence is computed from successive refinement.")
-            ;
+    std::chrono::steady_clock::time_point load_begin = std::chrono::steady_clock::now();
+    boost::shared_ptr<CGageAdaptor> image;
+    boost::shared_ptr<CStreamingAdaptor> streaming;
+    if(vm.count("stream"))
+    {
+        const std::string brick_file = vm.count("brick-file") ? vm["brick-file"].as<std::string>()
+                                                               : vm["input"].as<std::string>() + ".bricks";
+        const size_t cache_size = size_t(vm["stream"].as<unsigned>()) << 20;
 
-    po::variables_map vm;
-    po::store(po::parse_command_line(argc, argv, desc), vm);
-    po::notify(vm);
+        CStreamingAdaptor probe;
+        if(!probe.Open(brick_file, cache_size))
+        {
+            std::cerr << "\t* Writing brick file                            : " << brick_file << std::endl;
+            if(!CreateBrickFile(vm["input"].as<std::string>(), brick_file, vm["stream-brick-size"].as<unsigned>()))
+                return 1;
+        }
+        probe.Close();
 
-    if (vm.count("help"))
+        image = streaming = LoadStreamingImage(brick_file, cache_size);
+    }
+    else
+        image = LoadImage(vm["input"].as<std::string>(), !vm.count("no-mmap"));
+    if(!image)
+        return 1;
+    const double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_begin).count();
+
+    std::cerr << "\t* Input volume                                  : "
+              << image->GetWidth() << "x" << image->GetHeight() << "x" << image->GetDepth() << ", "
+              << (streaming ? "streamed" : image->IsMapped() ? "mapped" : "loaded") << " in " << load_seconds << " s" << std::endl;
+    if(streaming)
+        std::cerr << "\t* Brick cache                                   : "
+                  << streaming->GetCacheCapacity() / (1024.0 * 1024.0) << " MB" << std::endl;
+
+    if(vm.count("benchmark-layout"))
     {
-        std::cout << desc << "\n";
+        benchmark_layout(*image, vm["brick-size"].as<unsigned>(), d);
+        return 0;
+    }
+
+    if(!vm.count("color") or !vm.count("transparency"))
+    {
+        std::cerr << "--input requires --color and --transparency" << std::endl;
         return 1;
     }
 
-    std::cerr << "VRI (Volume Rendering Integral Discretization Schemes)"
-              << std::endl;
+    if(layout == "bricked")
+    {
+        if(!image->SetLayout(CGageAdaptor::BRICKED_LAYOUT, vm["brick-size"].as<unsigned>()))
+        {
+            std::cerr << "bricked layout failed, the brick size must be a power of two" << std::endl;
+            return 1;
+        }
+        std::cerr << "\t* Bricked layout                                : "
+                  << image->GetLayoutSize() / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+
+    if(vm.count("normal-cache"))
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if(!image->BuildNormalCache(vm["threads"].as<unsigned>()))
+            return 1;
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        const double volume = double(image->GetWidth()) * image->GetHeight() * image->GetDepth();
+
+        std::cerr << "\t* Normal cache                                  : "
+                  << image->GetNormalCacheSize() / (1024.0 * 1024.0) << " MB ("
+                  << image->GetNormalCacheSize() / volume << " bytes per voxel), built in "
+                  << seconds << " s" << std::endl;
+    }
+
+    // ADAPTIVE_RK steps across the uniform cells of the grid.
+    const bool adaptive = getMethod( vm["outer"].as<std::string>() ) == ADAPTIVE_RK;
+    CMinMaxGrid grid;
+    if(vm.count("skip-empty") or adaptive)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if(!grid.Build(*image, std::max(1u, vm["macro-cell-size"].as<unsigned>()), vm["threads"].as<unsigned>()))
+            return 1;
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        std::cerr << "\t* Min/max grid                                  : "
+                  << grid.GetCells(0) << "x" << grid.GetCells(1) << "x" << grid.GetCells(2) << " cells, "
+                  << grid.GetSize() / (1024.0 * 1024.0) << " MB, built in "
+                  << seconds << " s" << std::endl;
+    }
+
+    // gage probes write into the context, every thread gets a clone
+    // sharing the voxel data.
+    std::vector< boost::shared_ptr<CGageAdaptor> > images(std::max(1u, vm["threads"].as<unsigned>()));
+    images[0] = image;
+    for(unsigned t = 1; t < images.size(); ++t)
+        if(!(images[t] = image->Clone()))
+            return 1;
+
+    TransferFunction<Real> color, transparency;
+    if(!LoadTransferFunction(vm["color"].as<std::string>(), color) or
+       !LoadTransferFunction(vm["transparency"].as<std::string>(), transparency))
+        return 1;
+
+    EmptySpace<Real> empty_space(grid);
+    if(adaptive)
+    {
+        empty_space.classify_uniform(transparency, vm.count("shading") ? 0 : &color);
+        std::cerr << "\t* Uniform macro-cells                           : "
+                  << 100.0 * empty_space.uniform_cells() / std::max<size_t>(1, grid.GetCellCount()) << "%" << std::endl;
+    }
+    else if(vm.count("skip-empty"))
+        empty_space.classify(transparency);
+    if(vm.count("skip-empty"))
+        std::cerr << "\t* Empty macro-cells                             : "
+                  << 100.0 * empty_space.empty_cells() / std::max<size_t>(1, grid.GetCellCount()) << "%" << std::endl;
+
+    PreIntegrationTable<Real> pre_table;
+    if(getMethod( vm["outer"].as<std::string>() ) == PRE_INTEGRATED)
+    {
+        const unsigned layers = std::max(1u, vm["pre-table-lengths"].as<unsigned>());
+        std::vector<Real> lengths(layers);
+        for(unsigned k = 0; k < layers; ++k)
+            lengths[k] = d * (k + 1) / layers;
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        pre_table.build(color, transparency, vm["pre-table-size"].as<unsigned>(), lengths);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        std::cerr << "\t* Pre-integration table                         : "
+                  << pre_table.m_size << "x" << pre_table.m_size << "x" << layers << ", "
+                  << pre_table.bytes() / (1024.0 * 1024.0) << " MB, built in "
+                  << seconds << " s" << std::endl;
+    }
+
+    RenderSettings<Real> settings;
+    settings.step         = d;
+    settings.outer_method = getMethod( vm["outer"].as<std::string>() );
+    settings.inner_method = getMethod( vm["inner"].as<std::string>() );
+    settings.exp_method   = getMethod( vm["exp"].as<std::string>() );
+    settings.tile_size    = std::max(1u, vm["tile-size"].as<unsigned>());
+    settings.shading      = vm.count("shading") > 0;
+    settings.empty_space  = vm.count("skip-empty") ? &empty_space : 0;
+    settings.termination  = vm["termination"].as<float>();
+    settings.tolerance    = vm["tolerance"].as<float>();
+    settings.uniform      = adaptive ? &empty_space : 0;
+    settings.pre_table    = &pre_table;
+    if(settings.inner_method == MONTE_CARLO)
+    {
+        std::cerr << "MONTE_CARLO is not supported when rendering" << std::endl;
+        return 1;
+    }
+    if(settings.outer_method != ADAPTIVE_RK and settings.outer_method != PRE_INTEGRATED and
+       !OuterKernels< Real, Volume_solution<Real> >::supports(settings.outer_method, settings.inner_method,
+                                                              settings.exp_method))
+    {
+        std::cerr << "Integration method combination not supported" << std::endl;
+        return 1;
+    }
+
+    float look_at_f[3] = {0.5f * (image->GetWidth()  - 1),
+                          0.5f * (image->GetHeight() - 1),
+                          0.5f * (image->GetDepth()  - 1)};
+    if(vm.count("look-at"))
+        sscanf(vm["look-at"].as<std::string>().c_str(), "%f %f %f", &look_at_f[0], &look_at_f[1], &look_at_f[2]);
+
+    float eye_f[3] = {look_at_f[0], look_at_f[1],
+                      look_at_f[2] - 2.0f * std::max(image->GetWidth(), std::max(image->GetHeight(), image->GetDepth()))};
+    if(vm.count("eye"))
+        sscanf(vm["eye"].as<std::string>().c_str(), "%f %f %f", &eye_f[0], &eye_f[1], &eye_f[2]);
+
+    float up_f[3];
+    sscanf(vm["up"].as<std::string>().c_str(), "%f %f %f", &up_f[0], &up_f[1], &up_f[2]);
+
+    Real eye[3] = {eye_f[0], eye_f[1], eye_f[2]};
+    Real look_at[3] = {look_at_f[0], look_at_f[1], look_at_f[2]};
+    Real up[3] = {up_f[0], up_f[1], up_f[2]};
+    Camera<Real> camera(eye, look_at, up, vm["fov"].as<float>(),
+                        vm["width"].as<unsigned>(), vm["height"].as<unsigned>());
+
+    std::cerr << "\t* Image size                                    : "
+              << camera.m_width << "x" << camera.m_height << std::endl;
+    std::cerr << "\t* Threads                                       : "
+              << images.size() << std::endl;
+
+    std::vector<float> pixels;
+    RenderStats stats = render(images, color, transparency, camera, settings, pixels);
+
+    for(unsigned t = 0; t < stats.threads.size(); ++t)
+    {
+        const ThreadStats& s = stats.threads[t];
+        std::cerr << "\t  - Thread " << t << ": "
+                  << s.tiles << " tiles, "
+                  << s.steals << " stolen, "
+                  << s.rays << " rays, "
+                  << s.busy << " s busy of " << s.seconds << " s, "
+                  << (s.busy > 0.0 ? s.rays / s.busy : 0.0) << " rays/s" << std::endl;
+    }
+
+    std::cerr << "\t* Render time                                   : "
+              << stats.seconds << " s" << std::endl;
+    std::cerr << "\t* Rays/s                                        : "
+              << stats.rays / stats.seconds << std::endl;
+    std::cerr << "\t* Samples/s                                     : "
+              << stats.samples / stats.seconds << std::endl;
+    std::cerr << "\t* Samples/ray                                   : "
+              << double(stats.samples) / std::max<size_t>(1, stats.rays) << std::endl;
+    if(settings.termination > 0.0)
+        std::cerr << "\t* Early terminated rays                         : "
+                  << 100.0 * stats.terminated / std::max<size_t>(1, stats.rays) << "%, at "
+                  << 100.0 * stats.depth / std::max<size_t>(1, stats.terminated) << "% of their length on average" << std::endl;
+
+    if(streaming)
+    {
+        const CBrickCache::STATISTICS cache = streaming->GetCacheStatistics();
+        std::cerr << "\t* Brick cache hits/misses                       : "
+                  << cache.hits << "/" << cache.misses << " ("
+                  << 100.0 * cache.hits / std::max<uint64_t>(1, cache.hits + cache.misses) << "% hits), "
+                  << cache.prefetched << " prefetched, "
+                  << cache.evictions << " evicted, "
+                  << cache.bytesRead / (1024.0 * 1024.0) << " MB read" << std::endl;
+    }
+
+    rusage usage;
+    if(!getrusage(RUSAGE_SELF, &usage))
+        std::cerr << "\t* Peak resident set                             : "
+                  << usage.ru_maxrss / 1024.0 << " MB" << std::endl;
+
+    return SaveImage(vm["output"].as<std::string>(), pixels, camera.m_width, camera.m_height) ? 0 : 1;
+}
+
+#ifdef VRI_QUAD
+// Quad precision is for reference solutions, the renderer runs in float,
+// double or long double.
+template<>
+int render_volume(const po::variables_map&, __float128)
+{
+    std::cerr << "--input does not support --precision quad" << std::endl;
+    return 1;
+}
+#endif
+
+/**
+ * Runs the convergence check of every combination of --sweep-outer,
+ * --sweep-inner and --sweep-exp in parallel, and writes their errors and
+ * times to --sweep.
+ */
+template<typename Real>
+int sweep_methods(const po::variables_map& vm, const Real *start, const Real *end, Real d)
+{
+    typedef OuterKernels< Real, VRI_solution_00<Real> > Kernels;
+    const Method outer_methods[] = {RIEMANN, TRAPEZOID, SIMPSON, BOOLE,
+                                    GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, GAUSS_LEGENDRE_8,
+                                    GAUSS_LEGENDRE_20, GAUSS_KRONROD_15, GAUSS_KRONROD_21, ADAPTIVE_RK};
+    const std::vector<Method> outers = getMethods(vm["sweep-outer"].as<std::string>(), outer_methods, 11);
+    const std::vector<Method> inners = getMethods(vm["sweep-inner"].as<std::string>(), Kernels::INNER, 10);
+    const std::vector<Method> exps   = getMethods(vm["sweep-exp"].as<std::string>(), Kernels::EXP, 9);
+
+    //Number of refinement levels, as in the convergence check
+    const unsigned N = 8;
+    std::vector<SweepResult> results = sweep_tasks<Real>(outers, inners, exps, N);
+    const unsigned threads = std::max(1u, vm["threads"].as<unsigned>());
+
+    std::cerr << "\t* Sweep combinations                            : "
+              << results.size() / N << std::endl;
+    std::cerr << "\t* Threads                                       : "
+              << threads << std::endl;
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    size_t evaluations = 0;
+    sweep(start, end, d, Real(vm["tolerance"].as<float>()), results, threads, &evaluations);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cerr << "\t* Sweep time                                    : "
+              << seconds << " s" << std::endl;
+    std::cerr << "\t* Evaluations of C and T                        : "
+              << evaluations << std::endl;
+
+    const std::string output = vm["sweep"].as<std::string>();
+    const bool json = output.size() >= 5 and output.compare(output.size() - 5, 5, ".json") == 0;
+    if(output == "-")
+    {
+        write_sweep(std::cout, results, precision_name<Real>(), false);
+        return 0;
+    }
+
+    std::ofstream file(output.c_str());
+    if(!file)
+    {
+        std::cerr << "cannot write " << output << std::endl;
+        return 1;
+    }
+    write_sweep(file, results, precision_name<Real>(), json);
+    return file ? 0 : 1;
+}
+
+/**
+ * Runs the convergence check, the sweep, the dispatch benchmark or the renderer with
+ * the integrators instantiated for Real. report receives the error at the
+ * finest step of the convergence check, its time and its number of points.
+ */
+template<typename Real>
+int run(const po::variables_map& vm, PrecisionReport& report)
+{
+    std::cerr << "\t* Precision                                     : "
+              << precision_name<Real>() << std::endl;
 
     std::string start_s = vm["start"].as<std::string>();
     std::string end_s = vm["end"].as<std::string>();
@@ -76,20 +376,54 @@ int main(int argc, const char *argv[])
     std::cerr << "\t* Step size                                     : "
               << d << std::endl;
 
-//    boost::shared_ptr<CGageAdaptor> image = LoadImage("teste.h");
-//    image->GetValue(0.0, 0.0, 0.0);
+    if(vm.count("benchmark-dispatch"))
+    {
+        benchmark_dispatch<Real>(unsigned(1.0 / d + 0.5) + 1);
+        return 0;
+    }
+
+    if(vm.count("benchmark-exponential"))
+    {
+        benchmark_exponential<Real>(4096);
+        return 0;
+    }
+
+    if(vm.count("sweep"))
+        return sweep_methods(vm, start, end, d);
 
-    bool pre_integrated_test = false;
+    if(vm.count("input"))
+        return render_volume(vm, d);
+
+    bool pre_integrated_test = vm.count("pre-integrated") > 0;
     std::vector<Real> I;
+    // Errors of the extrapolated values, with --extrapolate.
+    std::vector<Real> E;
+    Real extrapolated = 0.0;
+    unsigned order = 0, increment = 0;
+    size_t points = 0;
+    // Evaluations of C and T, and the evaluations without reuse.
+    size_t evaluated = 0, requested = 0;
+    // Outer and inner error estimates of each level, with the Gauss-Kronrod rules.
+    std::vector< std::pair<Real, Real> > K;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
     if(!pre_integrated_test)
     {
         VRI_solution_00<Real> solve(start, end);
+        Integrator<Real> integrator;
 
         Method  exp_method   = getMethod( vm["exp"].as<std::string>() ),
                 inner_method = getMethod( vm["inner"].as<std::string>() ),
                 outer_method = getMethod( vm["outer"].as<std::string>() );
 
+        if(vm.count("extrapolate") and !getErrorExpansion(outer_method, inner_method, exp_method, order, increment))
+        {
+            std::cerr << "--extrapolate needs methods whose error expands in powers of the step, "
+                         "not MONTE_CARLO, LINEAR or ADAPTIVE_RK" << std::endl;
+            return 1;
+        }
+        Romberg<Real> romberg(order, increment);
+
         //Number of tests to be made
         unsigned N = 8;
 
@@ -98,36 +432,87 @@ int main(int argc, const char *argv[])
         //Domain size and step size
         Real D = 1.0;
         std::tr1::uniform_real<> dis(0.0, D);
-        for(unsigned test = 0; test < N; ++test)
+        if(outer_method == ADAPTIVE_RK)
         {
-            unsigned n = unsigned((D / d) + 1);
-            std::cout << 1.0 / (n-1) << " " << std::flush;
-            std::cerr << "(" << n-1 << "," << std::flush;
-
-            std::vector<Real> samples;
-            if(inner_method == MONTE_CARLO)
+            // One run per tolerance, ten times smaller each time. The step
+            // size is the initial step.
+            Real tolerance = vm["tolerance"].as<float>();
+            for(unsigned test = 0; test < N; ++test)
             {
-                // ... Create a new array everytime
-                samples.resize(n);
-                for(Real& v : samples)
-                    v = dis(gen);
-                std::sort(samples.begin(), samples.end());
-            }
+                std::cout << tolerance << " " << std::flush;
 
-            Real sol = 0.0, num = 0.0;
-            sol = solve.sol(D);
-            num = outer(solve, d, n, outer_method, inner_method, exp_method, samples);
+                size_t evaluations = 0;
+                Real sol = solve.sol(D);
+                Real num = outer_adaptive(solve, D, d, D, tolerance, Real(0.0), (Real*)0, (Real*)0, &evaluations);
+                std::cerr << "(" << evaluations << "," << std::flush;
+                points += evaluations;
 
-            I.push_back(fabs(sol-num));
-            d = d * 0.5;
+                I.push_back(fabs(sol-num));
+                tolerance = tolerance * 0.1;
 
-            std::cerr << I[I.size()-1] << ") " << std::flush;
+                std::cerr << I[I.size()-1] << ") " << std::flush;
+            }
+        }
+        else
+        {
+            // Every level goes through one cache of the points of the last
+            // level and of its midpoints, so each level only evaluates the
+            // points the coarser ones did not.
+            Real h = d;
+            for(unsigned test = 0; test < N; ++test)
+                h = h * 0.5;
+            Nested_solution< Real, VRI_solution_00<Real> > nested(solve, D, h);
+
+            for(unsigned test = 0; test < N; ++test)
+            {
+                unsigned n = unsigned((D / d) + 1);
+                std::cout << 1.0 / (n-1) << " " << std::flush;
+                std::cerr << "(" << n-1 << "," << std::flush;
+
+                std::vector<Real> samples;
+                if(inner_method == MONTE_CARLO)
+                {
+                    // ... Create a new array everytime
+                    samples.resize(n);
+                    for(Real& v : samples)
+                        v = dis(gen);
+                    std::sort(samples.begin(), samples.end());
+                }
+
+                Real sol = 0.0, num = 0.0;
+                sol = solve.sol(D);
+                num = integrator.outer(nested, d, n, outer_method, inner_method, exp_method, samples);
+                points += n;
+                if(outer_method == GAUSS_KRONROD_15 or outer_method == GAUSS_KRONROD_21 or
+                   inner_method == GAUSS_KRONROD_15 or inner_method == GAUSS_KRONROD_21)
+                    K.push_back(std::make_pair(integrator.outer_estimate(), integrator.inner_estimate()));
+
+                I.push_back(fabs(sol-num));
+                d = d * 0.5;
+                if(vm.count("extrapolate"))
+                {
+                    extrapolated = romberg.add(num);
+                    E.push_back(fabs(sol-extrapolated));
+                }
+
+                std::cerr << I[I.size()-1] << ") " << std::flush;
+            }
+            evaluated = nested.evaluations();
+            requested = nested.requests();
         }
     }
+    else if(vm.count("extrapolate"))
+    {
+        std::cerr << "--extrapolate does not support --pre-integrated" << std::endl;
+        return 1;
+    }
     else
     {
-//        Exp_solution_02<Real> solve(start, end);
-        Exp_solution_00<Real> solve(start, end);
+        // Exp_solution_02 has closed forms for every pre-integrated kernel.
+        Exp_solution_02<Real> solve(start, end);
+
+        const PreEmission emission = getPreEmission( vm["pre-emission"].as<std::string>() );
+        const PreAttenuation attenuation = getPreAttenuation( vm["pre-attenuation"].as<std::string>() );
 
         //Number of tests to be made
         unsigned N = 8;
@@ -136,33 +521,209 @@ int main(int argc, const char *argv[])
 
         //Domain size and step size
         Real D = 1.0;
-        Real d = 0.125;
         for(unsigned test = 0; test < N; ++test)
         {
             unsigned n = unsigned((D / d) + 1);
             std::cout << 1.0 / (n-1) << " " << std::flush;
             std::cerr << "(" << n-1 << "," << std::flush;
 
+            std::chrono::steady_clock::time_point test_begin = std::chrono::steady_clock::now();
             solve.d = d;
-    //        Real sol = solve.sol(D);
-    //        Real num = attenuation(solve, d, n);
             Real sol = solve.sol_vri(D);
-            Real num = pre_outer(solve, d, n);
+            Real num = pre_outer(solve, d, n, emission, attenuation);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - test_begin).count();
+            points += n;
 
             I.push_back(fabs(sol-num));
             d = d * 0.5;
 
-            std::cerr << I[I.size()-1] << ") " << std::flush;
+            std::cerr << I[I.size()-1] << "," << seconds << " s) " << std::flush;
         }
     }
 
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
     std::cout << std::endl;
     std::cerr << std::endl;
+    if(requested > 0)
+        std::cerr << "\t* Evaluations of C and T                        : "
+                  << evaluated << " of " << requested << " without reuse" << std::endl;
+    if(!K.empty())
+    {
+        std::cerr << "\t* Kronrod estimates (outer, optical depth)      :";
+        for(const std::pair<Real, Real>& k : K)
+            std::cerr << " (" << k.first << ", " << k.second << ")";
+        std::cerr << std::endl;
+    }
 
     for(const Real& err : I)
         std::cout << err << " ";
     std::cout << std::endl;
 
+    if(!E.empty())
+    {
+        for(const Real& err : E)
+            std::cout << err << " ";
+        std::cout << std::endl;
+
+        // Achieved order between consecutive levels.
+        std::cerr << "\t* Error expansion                               : d^"
+                  << order << " + d^" << order + increment << " + ..." << std::endl;
+        std::cerr << "\t* Extrapolated errors (order, achieved order)   : " << E[0];
+        for(size_t k = 1; k < E.size(); ++k)
+            std::cerr << " (" << order + k * increment << ", "
+                      << (E[k] > 0.0 ? log2(double(E[k-1] / E[k])) : 0.0) << ") " << E[k];
+        std::cerr << std::endl;
+        std::cerr << "\t* Extrapolated value                            : "
+                  << std::setprecision(20) << extrapolated << std::setprecision(6) << std::endl;
+        // The error of the finest level falls as d^order.
+        if(E.back() > 0.0 and E.back() < I.back())
+            std::cerr << "\t* Evaluations to reach it by refining alone     : about "
+                      << evaluated * pow(double(I.back() / E.back()), 1.0 / order) << std::endl;
+    }
+
+    report.name    = precision_name<Real>();
+    report.error   = double(I.back());
+    report.seconds = seconds;
+    report.points  = points;
+
+    return 0;
+}
+
+// Precisions selected by --precision, in the order they were given.
+std::vector<std::string> getPrecisions(const std::string &p)
+{
+    std::vector<std::string> precisions;
+    if(p == "all")
+    {
+        precisions.push_back("float");
+        precisions.push_back("double");
+        precisions.push_back("long-double");
+#ifdef VRI_QUAD
+        precisions.push_back("quad");
+#endif
+        return precisions;
+    }
+
+    size_t begin = 0;
+    while(begin <= p.size())
+    {
+        const size_t end = std::min(p.find(',', begin), p.size());
+        precisions.push_back(p.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return precisions;
+}
+
+int main(int argc, const char *argv[])
+{
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("start", po::value< std::string >()->default_value("0 0 0"), "ray starting point")
+        ("end", po::value< std::string >()->default_value("1 0 0"), "ray ending point")
+        ("inner", po::value< std::string>()->default_value("RIEMANN"), "inner integral numerical integration method: RIEMANN, MONTE_CARLO, TRAPEZOID, GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, GAUSS_LEGENDRE_8, GAUSS_LEGENDRE_20, GAUSS_KRONROD_15, GAUSS_KRONROD_21 (Gauss-Kronrod 7-15 and 10-21, with an error estimate), SIMPSON, BOOLE")
+        ("outer", po::value< std::string>()->default_value("RIEMANN"), "outer integral numerical integration method: RIEMANN, MONTE_CARLO, TRAPEZOID, SIMPSON, BOOLE, GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, GAUSS_LEGENDRE_8, GAUSS_LEGENDRE_20, GAUSS_KRONROD_15, GAUSS_KRONROD_21 (the Gauss rules with --exp EXACT only), ADAPTIVE_RK (Dormand-Prince 5(4) with adaptive steps, see --tolerance), PRE_INTEGRATED (when rendering, segments looked up in a pre-integration table of the transfer functions)")
+        ("pre-table-size", po::value< unsigned >()->default_value(256), "entries of the PRE_INTEGRATED table along the front and back value axes")
+        ("pre-table-lengths", po::value< unsigned >()->default_value(1), "segment lengths of the PRE_INTEGRATED table, evenly spaced up to the step size. Other lengths rescale the nearest one")
+        ("tolerance", po::value< float >()->default_value(1.0E-4), "local error tolerance of --outer ADAPTIVE_RK, relative to 1 + |I| and 1 + the optical depth. When rendering, the step size is the largest step, except across the macro-cells (see --macro-cell-size) where the transfer functions are constant or the transparency is zero")
+        ("exp", po::value< std::string>()->default_value("QUADRATIC"), "exponential approximation method: LINEAR, QUADRATIC, CUBIC, QUARTIC, QUINTIC (series truncated after 1 to 5 terms), PADE_1_1, PADE_2_2, PADE_3_3 (diagonal Pade approximants), EXACT")
+        ("step-size", po::value< float >()->default_value(0.125E+0), "step size along the parameterized ray. The ray is parameterized by as X = start + delta * (end - start), where delta is the step size. When rendering, the step size is given in voxels")
+        ("input", po::value< std::string >(), "input nrrd scalar field. Enables the render mode")
+        ("color", po::value< std::string >(), "input nrrd color transfer function")
+        ("transparency", po::value< std::string >(), "input nrrd extinction coefficient")
+        ("output", po::value< std::string >()->default_value("image.nrrd"), "rendered image")
+        ("width", po::value< unsigned >()->default_value(256), "rendered image width")
+        ("height", po::value< unsigned >()->default_value(256), "rendered image height")
+        ("eye", po::value< std::string >(), "camera position, in voxels. Defaults to a point in front of the volume along -z")
+        ("look-at", po::value< std::string >(), "camera target, in voxels. Defaults to the volume center")
+        ("up", po::value< std::string >()->default_value("0 1 0"), "camera up vector")
+        ("fov", po::value< float >()->default_value(30.0), "camera vertical field of view, in degrees")
+        ("threads", po::value< unsigned >()->default_value(std::max(1u, std::thread::hardware_concurrency())), "number of threads of the renderer and of --sweep")
+        ("tile-size", po::value< unsigned >()->default_value(16), "render tile size, in pixels")
+        ("shading", "shade the rendered samples with a headlight, using the gradient of the scalar field")
+        ("no-mmap", "read the whole --input volume into memory instead of mapping raw encoded volumes")
+        ("stream", po::value< unsigned >(), "stream --input from a brick file through a cache of this many MB instead of opening it whole")
+        ("brick-file", po::value< std::string >(), "brick file used by --stream, written from --input when it cannot be opened. Defaults to the input name followed by .bricks")
+        ("stream-brick-size", po::value< unsigned >()->default_value(32), "brick size, in voxels, of the brick files written for --stream")
+        ("layout", po::value< std::string >()->default_value("linear"), "voxel storage read by the renderer: linear, or bricked (a copy of the volume in bricks stored in Z-order)")
+        ("brick-size", po::value< unsigned >()->default_value(8), "brick size of the bricked layout, in voxels. Must be a power of two")
+        ("benchmark-layout", "compare the samples/s and cache misses of the linear and bricked layouts for rays along each axis and oblique rays through --input")
+        ("benchmark-dispatch", "compare the time per point of the integration kernels specialized for each combination of --outer, --inner and --exp with testing the methods at every sample, on the analytic solution with 1 / --step-size intervals")
+        ("benchmark-exponential", "compare the time per value and the relative errors of the Taylor and Pade approximations of exp(-s) of each order with std::exp, for optical depths s in [0, 1]")
+        ("normal-cache", "precompute the normals at every voxel before rendering, and interpolate them instead of convolving the derivative kernel at every shaded sample")
+        ("termination", po::value< float >()->default_value(0.0), "stop the rays once their transmittance falls below this threshold; 0 integrates whole rays")
+        ("skip-empty", "skip the parts of the rays crossing macro-cells where the transparency transfer function is zero")
+        ("macro-cell-size", po::value< unsigned >()->default_value(8), "macro-cell size of --skip-empty and of the steps of --outer ADAPTIVE_RK, in voxels")
+        ("pre-integrated", "check the convergence of the pre-integrated evaluation instead of the numerical integration methods")
+        ("pre-emission", po::value< std::string >()->default_value("1ST"), "pre-integrated segment emission: 1ST, 2ND, 2ND_APPROX")
+        ("pre-attenuation", po::value< std::string >()->default_value("1ST"), "pre-integrated segment attenuation: 1ST, 2ND")
+        ("precision", po::value< std::string >()->default_value("long-double"), "floating-point type of the integrators: float, double, long-double, quad (when built with VRI_QUAD, for reference solutions only), a comma-separated list of them or all. Several precisions check the convergence at each one and compare them")
+        ("sweep", po::value< std::string >()->implicit_value("-"), "check the convergence of every combination of --sweep-outer, --sweep-inner and --sweep-exp in parallel on --threads threads, starting from --step-size (and --tolerance for ADAPTIVE_RK), and write the step size, error, samples and time of every level to this file: JSON when it ends in .json, CSV otherwise, CSV on the standard output for -")
+        ("sweep-outer", po::value< std::string >()->default_value("all"), "comma-separated outer methods of --sweep, or all: RIEMANN, TRAPEZOID, SIMPSON, BOOLE, GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, GAUSS_LEGENDRE_8, GAUSS_LEGENDRE_20, GAUSS_KRONROD_15, GAUSS_KRONROD_21, ADAPTIVE_RK")
+        ("sweep-inner", po::value< std::string >()->default_value("all"), "comma-separated inner methods of --sweep, or all: MONTE_CARLO, RIEMANN, TRAPEZOID, SIMPSON, GAUSS_QUADRATURE, GAUSS_QUADRATURE_5, GAUSS_LEGENDRE_8, GAUSS_LEGENDRE_20, GAUSS_KRONROD_15, GAUSS_KRONROD_21")
+        ("sweep-exp", po::value< std::string >()->default_value("all"), "comma-separated exponential methods of --sweep, or all: LINEAR, QUADRATIC, CUBIC, QUARTIC, QUINTIC, PADE_1_1, PADE_2_2, PADE_3_3, EXACT")
+        ("extrapolate", "combine the results of the levels of the convergence check through a Richardson (Romberg) tableau built on the error expansion of --outer, --inner and --exp, and report the errors of the extrapolated values and their orders")
+        ("check-convergence", "check the method convergence. If an analytical solution is specified, then the solution is used. Otherwise, the convergence is computed from successive refinement.")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc << "\n";
+        return 1;
+    }
+
+    std::cerr << "VRI (Volume Rendering Integral Discretization Schemes)"
+              << std::endl;
+
+    const std::vector<std::string> precisions = getPrecisions(vm["precision"].as<std::string>());
+    if(precisions.size() > 1 and (vm.count("input") or vm.count("benchmark-dispatch") or
+                                  vm.count("benchmark-exponential") or vm.count("sweep")))
+    {
+        std::cerr << "--input, --benchmark-dispatch, --benchmark-exponential and --sweep run at a single --precision" << std::endl;
+        return 1;
+    }
+
+    std::vector<PrecisionReport> reports;
+    for(const std::string& precision : precisions)
+    {
+        PrecisionReport report = {precision.c_str(), 0.0, 0.0, 0};
+        int status;
+        if(precision == "float")
+            status = run<float>(vm, report);
+        else if(precision == "double")
+            status = run<double>(vm, report);
+        else if(precision == "long-double")
+            status = run<long double>(vm, report);
+#ifdef VRI_QUAD
+        else if(precision == "quad")
+            status = run<__float128>(vm, report);
+#endif
+        else
+        {
+            std::cerr << "unknown precision " << precision << std::endl;
+            return 1;
+        }
+        if(status)
+            return status;
+        reports.push_back(report);
+    }
+
+    if(reports.size() > 1)
+    {
+        std::cerr << "\t* Precision    Finest error          Seconds       Points/s" << std::endl;
+        for(const PrecisionReport& r : reports)
+            std::cerr << "\t  " << std::left << std::setw(12) << r.name << " "
+                      << std::setw(21) << std::setprecision(6) << r.error << " "
+                      << std::setw(13) << r.seconds << " "
+                      << r.points / std::max(r.seconds, 1e-9) << std::right << std::endl;
+    }
+
     return 0;
 }
 
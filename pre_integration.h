@@ -1,35 +1,123 @@
 #ifndef PRE_INTEGRATION_H
 #define PRE_INTEGRATION_H
 
-template<typename Real>
+#include <string>
+#include <cassert>
+#include <algorithm>
+
+#include "integration.h"
+
+// Closed forms of the emission and attenuation of a ray segment, from the
+// scalar field at its ends (1ST) or at its ends and an inner point (2ND).
+enum PreEmission
+{
+    EMISSION_1ST,
+    EMISSION_2ND,
+    EMISSION_2ND_APPROX
+};
+
+enum PreAttenuation
+{
+    ATTENUATION_1ST,
+    ATTENUATION_2ND
+};
+
 inline
-Real pre_attenuation(const Solution<Real> &solve, const Real d, const unsigned n)
+PreEmission getPreEmission(const std::string &m)
 {
-    Real integral = 1.0;
-    for(unsigned j = 0; j < n; ++j)
+    if(m == "1ST")                  return EMISSION_1ST;
+    if(m == "2ND")                  return EMISSION_2ND;
+    if(m == "2ND_APPROX")           return EMISSION_2ND_APPROX;
+    assert(0 and "Pre-integrated emission not found");
+    return PreEmission(0);
+}
+
+inline
+PreAttenuation getPreAttenuation(const std::string &m)
+{
+    if(m == "1ST")                  return ATTENUATION_1ST;
+    if(m == "2ND")                  return ATTENUATION_2ND;
+    assert(0 and "Pre-integrated attenuation not found");
+    return PreAttenuation(0);
+}
+
+template<typename Real, typename S>
+inline
+Real pre_emission(const S &solve, const Point<Real>& x, PreEmission emission)
+{
+    if(emission == EMISSION_1ST)
+        return solve.emission_1st(x);
+    else if(emission == EMISSION_2ND)
+        return solve.emission_2nd(x);
+    else if(emission == EMISSION_2ND_APPROX)
+        return solve.emission_2nd_approx(x);
+    else
+        assert(0);
+    return Real(0.0);
+}
+
+template<typename Real, typename S>
+inline
+Real pre_attenuation(const S &solve, const Point<Real>& x, PreAttenuation attenuation)
+{
+    if(attenuation == ATTENUATION_1ST)
+        return solve.attenuation_1st(x);
+    else if(attenuation == ATTENUATION_2ND)
+        return solve.attenuation_2nd(x);
+    else
+        assert(0);
+    return Real(1.0);
+}
+
+// The attenuation factors of pre-integrated segments, which are exp(-s)
+// already, as the approximation of attenuate().
+struct PreAttenuated
+{
+    template<typename Real>
+    static inline void evaluate(const Real *s, Real *values, size_t count)
     {
-        integral *= solve.attenuation_1st(solve.X(j*d));
-//        integral *= solve.attenuation_2nd(solve.X(j*d));
+        std::copy(s, s + count, values);
     }
-    return integral;
-}
+};
 
-template<typename Real>
+/**
+ * Sums the emission of the n-1 segments [i*d, (i+1)*d], each attenuated by
+ * the segments in front of it. The segments are evaluated once each, in
+ * batches, and attenuate() carries the attenuation of the segments in front
+ * across the batch.
+ */
+template<typename Real, typename S>
 inline
-Real pre_outer(const Solution<Real> &solve,
+Real pre_outer(const S &solve,
            const Real d,
-           const unsigned n)
+           const unsigned n,
+           PreEmission emission = EMISSION_1ST,
+           PreAttenuation attenuation = ATTENUATION_1ST)
 {
-    Real I = 0.0;
+    enum { BATCH = 64 };
+    CompensatedSum<Real> I;
+    Real alpha = 1.0;
+    Real emissions[BATCH], factors[BATCH], alphas[BATCH];
 
-    for(unsigned i = 0; i < n-1; ++i)
+    for(unsigned i = 0; i < n-1; i += BATCH)
     {
-        I += solve.emission_1st(solve.X(i*d)) * pre_attenuation(solve, d, i);
-//        I += solve.emission_2nd(solve.X(i*d)) * pre_attenuation(solve, d, i);
-//        I += solve.emission_2nd_approx(solve.X(i*d)) * pre_attenuation(solve, d, i);
+        const unsigned count = std::min<unsigned>(BATCH, n-1 - i);
+        for(unsigned k = 0; k < count; ++k)
+        {
+            const Point<Real> x = solve.X((i+k)*d);
+            emissions[k] = pre_emission(solve, x, emission);
+            factors[k] = pre_attenuation(solve, x, attenuation);
+        }
+
+        // alphas[k] is the transmittance after segment k, the one in front
+        // of segment k+1.
+        I += emissions[0] * alpha;
+        alpha = attenuate<PreAttenuated>(alpha, factors, alphas, count);
+        for(unsigned k = 1; k < count; ++k)
+            I += emissions[k] * alphas[k-1];
     }
 
-    return I;
+    return I.value();
 }
 
 #endif // PRE_INTEGRATION_H
@@ -0,0 +1,158 @@
+#ifndef PRE_INTEGRATION_TABLE_H
+#define PRE_INTEGRATION_TABLE_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "transfer_function.h"
+
+/**
+ * Pre-integrated color and opacity of a ray segment along which the scalar
+ * value goes linearly from s_front to s_back, for the color and extinction
+ * transfer functions of the renderer, indexed by (s_front, s_back) and
+ * optionally by the segment length.
+ *
+ * With P and K the integrals of the extinction T and of C T from the start
+ * of the domain, a segment of length d between entries i and j has
+ *
+ *     opacity = 1 - exp(-d (P[j] - P[i]) / (j - i))
+ *     color   = (K[j] - K[i]) / (P[j] - P[i]) * opacity
+ *
+ * i.e. the extinction weighted mean color, which is exact when the color is
+ * constant along the segment. Every entry is two differences of the prefix
+ * integrals, so building a table of N x N entries takes O(N^2) rather than
+ * the O(N^3) of integrating every entry.
+ */
+template<typename Real>
+struct PreIntegrationTable
+{
+    PreIntegrationTable() : m_size(0), m_min(0.0), m_max(1.0)
+    {
+    }
+
+    /**
+     * Builds size x size entries over the union of the transfer function
+     * domains, for the given segment lengths (in increasing order), in the
+     * same units as the lengths passed to fetch().
+     */
+    void build(const TransferFunction<Real>& color,
+               const TransferFunction<Real>& transparency,
+               unsigned size, const std::vector<Real>& lengths)
+    {
+        m_size = std::max(2u, size);
+        m_min = std::min(color.m_min, transparency.m_min);
+        m_max = std::max(color.m_max, transparency.m_max);
+        m_lengths = lengths;
+
+        std::vector<Real> c(m_size), t(m_size), P(m_size, 0.0), K(m_size, 0.0);
+        for(unsigned i = 0; i < m_size; ++i)
+        {
+            const Real v = value(i);
+            c[i] = color(v);
+            t[i] = transparency(v);
+        }
+        // Trapezoid rule between entries, in units of entries.
+        for(unsigned i = 1; i < m_size; ++i)
+        {
+            P[i] = P[i-1] + 0.5 * (t[i-1] + t[i]);
+            K[i] = K[i-1] + 0.5 * (t[i-1] * c[i-1] + t[i] * c[i]);
+        }
+
+        m_table.resize(2 * m_lengths.size() * m_size * m_size);
+        for(size_t k = 0; k < m_lengths.size(); ++k)
+        {
+            const Real d = m_lengths[k];
+            for(unsigned i = 0; i < m_size; ++i)
+            {
+                for(unsigned j = 0; j < m_size; ++j)
+                {
+                    Real tau, mean;
+                    if(i == j)
+                    {
+                        tau = t[i];
+                        mean = c[i];
+                    }
+                    else
+                    {
+                        const Real dP = P[j] - P[i];
+                        tau = dP / (Real(j) - Real(i));
+                        mean = dP != 0.0 ? (K[j] - K[i]) / dP : Real(0.0);
+                    }
+                    const Real opacity = 1.0 - std::exp(-d * tau);
+                    float *entry = &m_table[2 * ((k * m_size + i) * m_size + j)];
+                    entry[0] = float(mean * opacity);
+                    entry[1] = float(opacity);
+                }
+            }
+        }
+    }
+
+    /**
+     * Color and opacity of a segment of length d from front to back, with a
+     * bilinear fetch between entries. Lengths between two layers are
+     * interpolated, lengths outside rescale the nearest layer.
+     */
+    inline void fetch(Real front, Real back, Real d, Real& color, Real& opacity) const
+    {
+        const Real x = entry(front), y = entry(back);
+        const unsigned i = std::min(unsigned(x), m_size - 2);
+        const unsigned j = std::min(unsigned(y), m_size - 2);
+        const Real fx = x - i, fy = y - j;
+
+        size_t k = 0;
+        Real fk = 0.0;
+        if(m_lengths.size() > 1 and d > m_lengths.front())
+        {
+            k = std::upper_bound(m_lengths.begin(), m_lengths.end(), d) - m_lengths.begin() - 1;
+            if(k + 1 < m_lengths.size())
+                fk = (d - m_lengths[k]) / (m_lengths[k+1] - m_lengths[k]);
+        }
+
+        color = opacity = 0.0;
+        for(unsigned l = 0; l < (fk > 0.0 ? 2u : 1u); ++l)
+        {
+            const float *e = &m_table[2 * (((k + l) * m_size + i) * m_size + j)];
+            const float *f = e + 2 * m_size;
+            const Real w = l ? fk : 1.0 - fk;
+            color   += w * ((1.0 - fy) * ((1.0 - fx) * e[0] + fx * f[0]) + fy * ((1.0 - fx) * e[2] + fx * f[2]));
+            opacity += w * ((1.0 - fy) * ((1.0 - fx) * e[1] + fx * f[1]) + fy * ((1.0 - fx) * e[3] + fx * f[3]));
+        }
+
+        // Outside of the layers, the optical depth scales with the length
+        // and the mean color does not change.
+        if(fk == 0.0 and d != m_lengths[k] and opacity > 0.0)
+        {
+            const Real scaled = 1.0 - std::pow(1.0 - std::min(opacity, Real(1.0 - 1e-7)), d / m_lengths[k]);
+            color *= scaled / opacity;
+            opacity = scaled;
+        }
+    }
+
+    // Memory used by the table, in bytes.
+    size_t bytes() const
+    {
+        return m_table.size() * sizeof(float);
+    }
+
+    unsigned m_size;
+    Real m_min;
+    Real m_max;
+    std::vector<Real> m_lengths;
+    // (color, opacity) pairs, by length, front entry and back entry.
+    std::vector<float> m_table;
+
+private:
+    inline Real value(unsigned i) const
+    {
+        return m_min + (m_max - m_min) * Real(i) / Real(m_size - 1);
+    }
+
+    inline Real entry(Real v) const
+    {
+        const Real t = (v - m_min) / (m_max - m_min) * (m_size - 1);
+        return std::min(std::max(t, Real(0.0)), Real(m_size - 1));
+    }
+};
+
+#endif // PRE_INTEGRATION_TABLE_H
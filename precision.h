@@ -0,0 +1,44 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// The integrators call the math functions unqualified, as sin(x), so that
+// they resolve to the overload of their Real type. <math.h> brings the
+// float and long double overloads of <cmath> into the global namespace;
+// with <cmath> alone, long double arguments go through the double ones.
+#include <math.h>
+#include <ostream>
+
+#ifdef VRI_QUAD
+#include <quadmath.h>
+
+// Quad precision through libquadmath, for reference solutions.
+inline __float128 sin(__float128 x)   { return sinq(x); }
+inline __float128 cos(__float128 x)   { return cosq(x); }
+inline __float128 tan(__float128 x)   { return tanq(x); }
+inline __float128 atan(__float128 x)  { return atanq(x); }
+inline __float128 exp(__float128 x)   { return expq(x); }
+inline __float128 log(__float128 x)   { return logq(x); }
+inline __float128 sqrt(__float128 x)  { return sqrtq(x); }
+inline __float128 erf(__float128 x)   { return erfq(x); }
+inline __float128 fabs(__float128 x)  { return fabsq(x); }
+inline __float128 floor(__float128 x) { return floorq(x); }
+inline __float128 ceil(__float128 x)  { return ceilq(x); }
+inline __float128 pow(__float128 x, __float128 y) { return powq(x, y); }
+
+inline std::ostream& operator<<(std::ostream& out, __float128 x)
+{
+    char buffer[64];
+    quadmath_snprintf(buffer, sizeof(buffer), "%.*Qg", int(out.precision()), x);
+    return out << buffer;
+}
+#endif
+
+template<typename Real> inline const char *precision_name();
+template<> inline const char *precision_name<float>()       { return "float"; }
+template<> inline const char *precision_name<double>()      { return "double"; }
+template<> inline const char *precision_name<long double>() { return "long-double"; }
+#ifdef VRI_QUAD
+template<> inline const char *precision_name<__float128>()  { return "quad"; }
+#endif
+
+#endif // PRECISION_H
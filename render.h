@@ -0,0 +1,561 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include "GageAdaptor.h"
+#include "solutions.h"
+#include "integration.h"
+#include "transfer_function.h"
+#include "scheduler.h"
+#include "empty_space.h"
+#include "pre_integration_table.h"
+
+/**
+ * Pinhole camera. Rays leave m_eye through the center of each pixel of a
+ * width x height image plane placed at unit distance along the viewing
+ * direction.
+ */
+template<typename Real>
+struct Camera
+{
+    Camera(const Real *eye, const Real *look_at, const Real *up,
+           Real fov, unsigned width, unsigned height) :
+        m_width(width), m_height(height)
+    {
+        Real w[3], u[3], v[3];
+        for(unsigned i = 0; i < 3; ++i)
+            w[i] = look_at[i] - eye[i];
+
+        u[0] = w[1]*up[2] - w[2]*up[1];
+        u[1] = w[2]*up[0] - w[0]*up[2];
+        u[2] = w[0]*up[1] - w[1]*up[0];
+
+        v[0] = u[1]*w[2] - u[2]*w[1];
+        v[1] = u[2]*w[0] - u[0]*w[2];
+        v[2] = u[0]*w[1] - u[1]*w[0];
+
+        Real lw = magnitue(w), lu = magnitue(u), lv = magnitue(v);
+        Real h = std::tan(0.5 * fov * PI / 180.0);
+        Real aspect = Real(width) / Real(height);
+        for(unsigned i = 0; i < 3; ++i)
+        {
+            m_eye[i] = eye[i];
+            m_w[i] = w[i] / lw;
+            m_u[i] = u[i] / lu * h * aspect;
+            m_v[i] = v[i] / lv * h;
+        }
+    }
+
+    inline void ray(unsigned i, unsigned j, Real *dir) const
+    {
+        Real x = 2.0 * (i + 0.5) / m_width - 1.0;
+        Real y = 1.0 - 2.0 * (j + 0.5) / m_height;
+        for(unsigned k = 0; k < 3; ++k)
+            dir[k] = m_w[k] + x * m_u[k] + y * m_v[k];
+        Real l = magnitue(dir);
+        for(unsigned k = 0; k < 3; ++k)
+            dir[k] /= l;
+    }
+
+    Real m_eye[3];
+    Real m_u[3];
+    Real m_v[3];
+    Real m_w[3];
+    unsigned m_width;
+    unsigned m_height;
+};
+
+/**
+ * Ray segment through a scalar volume. T and C are the extinction and color
+ * transfer functions applied to the probed value; T is scaled by the segment
+ * length so that the integral over the [0, 1] parameter range has physical
+ * units. With a light direction set, C is also Lambert shaded using the
+ * normal from the same probe as the value.
+ */
+template<typename Real>
+struct Volume_solution : public Static_solution<Volume_solution<Real>, Real>
+{
+    typedef Static_solution<Volume_solution<Real>, Real> Base;
+    using Base::T;
+    using Base::C;
+
+    enum { BATCH = 64 };
+
+    // Values reconstructed at the grid points from first on, and their
+    // normals when shading.
+    struct Batch
+    {
+        Batch() : first(0)
+        {
+        }
+
+        size_t first;
+        std::vector<GAGE_TYPE> values;
+        std::vector<GAGE_TYPE> normals;
+    };
+
+    Volume_solution(const Real *start, const Real *end,
+                    const CGageAdaptor& image,
+                    const TransferFunction<Real>& color,
+                    const TransferFunction<Real>& transparency) :
+        Base(start, end),
+        m_image(image),
+        m_color(color),
+        m_transparency(transparency),
+        m_length(magnitue(this->m_step)),
+        m_last_l(-1.0),
+        m_last_s(0.0),
+        m_last_shade(1.0),
+        m_light(0),
+        m_probes(0),
+        m_h(0.0),
+        m_count(0)
+    {
+    }
+    // Off the grid values take the native reconstruction of GetValues() as
+    // well, one position at a time.
+    inline Real s(const Point<Real>& x) const
+    {
+        const float position[3] = {float(x.x), float(x.y), float(x.z)};
+        GAGE_TYPE value;
+        m_image.GetValues(position, 1, &value);
+        ++m_probes;
+        return value;
+    }
+    // Values at the count grid parameters l = k * h are reconstructed in
+    // batches along the ray, the first time one of them is asked for. The
+    // batches start at multiples of their size and the last two are kept:
+    // the outer method reads the emission a chunk ahead of the inner one,
+    // and each grid point is probed once.
+    void prefetch(Real h, size_t count)
+    {
+        m_h = h;
+        m_count = count;
+        for(Batch& b : m_batches)
+        {
+            b.first = 0;
+            b.values.clear();
+        }
+    }
+    const Batch& batch(size_t k) const
+    {
+        for(const Batch& b : m_batches)
+            if(k >= b.first and k < b.first + b.values.size())
+                return b;
+        std::swap(m_batches[0], m_batches[1]);
+        fill(m_batches[0], k - k % BATCH);
+        return m_batches[0];
+    }
+    void fill(Batch& batch, size_t k) const
+    {
+        const Point<Real> x = this->X(k * m_h);
+        const float start[3] = {float(x.x), float(x.y), float(x.z)};
+        const float step[3] = {float(this->m_step[0] * m_h),
+                               float(this->m_step[1] * m_h),
+                               float(this->m_step[2] * m_h)};
+        batch.first = k;
+        batch.values.resize(std::min<size_t>(BATCH, m_count - k));
+        m_image.GetValues(start, step, unsigned(batch.values.size()), &batch.values[0]);
+        m_probes += batch.values.size();
+        if(m_light)
+        {
+            batch.normals.resize(3 * batch.values.size());
+            m_image.GetNormals(start, step, unsigned(batch.values.size()), &batch.normals[0]);
+        }
+    }
+    inline Real lambert(const GAGE_TYPE *normal) const
+    {
+        const Real n_dot_l = normal[0] * m_light[0]
+                           + normal[1] * m_light[1]
+                           + normal[2] * m_light[2];
+        // 20% ambient, 80% two-sided diffuse.
+        return 0.2 + 0.8 * std::fabs(n_dot_l);
+    }
+    // Headlight shading, light is the unit direction towards the light.
+    void shade(const Real *light)
+    {
+        m_light = light;
+    }
+    // outer() asks for C and T at the same parameter, probe only once.
+    inline Real value(Real l) const
+    {
+        if(m_h > 0.0)
+        {
+            const Real k = l / m_h;
+            const size_t i = size_t(k + 0.5);
+            if(std::fabs(k - Real(i)) < 1e-4 and i < m_count)
+            {
+                const Batch& b = batch(i);
+                if(m_light)
+                    m_last_shade = lambert(&b.normals[3 * (i - b.first)]);
+                return b.values[i - b.first];
+            }
+        }
+        if(l != m_last_l)
+        {
+            const Point<Real> x = this->X(l);
+            if(m_light)
+            {
+                const CGageAdaptor::ANSWER& answer = m_image.Probe(x.x, x.y, x.z);
+                m_last_shade = lambert(answer.normal);
+                m_last_s = *answer.value;
+                ++m_probes;
+            }
+            else
+                m_last_s = s(x);
+            m_last_l = l;
+        }
+        return m_last_s;
+    }
+    inline Real T(Real l) const
+    {
+        return m_transparency(value(l)) * m_length;
+    }
+    inline Real C(Real l) const
+    {
+        const Real v = value(l);
+        return m_color(v) * m_last_shade;
+    }
+    // C then T at each parameter, so that both use the same probe.
+    inline void emission(const Real *l, Real *out, size_t n) const
+    {
+        for(size_t i = 0; i < n; ++i)
+            out[i] = C(l[i]) * T(l[i]);
+    }
+
+    const CGageAdaptor& m_image;
+    const TransferFunction<Real>& m_color;
+    const TransferFunction<Real>& m_transparency;
+    Real m_length;
+    mutable Real m_last_l;
+    mutable Real m_last_s;
+    mutable Real m_last_shade;
+    const Real *m_light;
+    mutable size_t m_probes;
+    Real m_h;
+    size_t m_count;
+    // The last two batches, the latest first.
+    mutable Batch m_batches[2];
+};
+
+// Rays are only integrated on the grid, without the MONTE_CARLO kernels.
+template<typename Real>
+struct MonteCarloKernels< Volume_solution<Real> >
+{
+    enum { value = false };
+};
+
+template<typename Real>
+struct RenderSettings
+{
+    Real step;
+    Method outer_method;
+    Method inner_method;
+    Method exp_method;
+    unsigned tile_size;
+    bool shading;
+    // Cells the rays skip, none when null.
+    const EmptySpace<Real> *empty_space;
+    // Rays stop once their transmittance falls below it, 0 to never stop.
+    Real termination;
+    // Local error tolerance of ADAPTIVE_RK.
+    Real tolerance;
+    // Cells ADAPTIVE_RK steps across, none when null.
+    const EmptySpace<Real> *uniform;
+    // Segment colors and opacities of PRE_INTEGRATED.
+    const PreIntegrationTable<Real> *pre_table;
+};
+
+struct RenderStats
+{
+    size_t rays;
+    size_t samples;
+    // Rays that stopped before leaving the volume, and the sum over them of
+    // the fraction of their length that was integrated.
+    size_t terminated;
+    double depth;
+    double seconds;
+    std::vector<ThreadStats> threads;
+};
+
+/**
+ * Clips the ray origin + t * dir against the volume bounding box in index
+ * space. Returns false if the ray misses the volume.
+ */
+template<typename Real>
+inline
+bool clip_ray(const CGageAdaptor& image, const Real *origin, const Real *dir,
+              Real& t0, Real& t1)
+{
+    const Real size[3] = {Real(image.GetWidth()  - 1),
+                          Real(image.GetHeight() - 1),
+                          Real(image.GetDepth()  - 1)};
+    t0 = 0.0;
+    t1 = std::numeric_limits<Real>::max();
+    for(unsigned i = 0; i < 3; ++i)
+    {
+        if(dir[i] == 0.0)
+        {
+            if(origin[i] < 0.0 or origin[i] > size[i])
+                return false;
+            continue;
+        }
+        Real a = (0.0     - origin[i]) / dir[i];
+        Real b = (size[i] - origin[i]) / dir[i];
+        if(a > b)
+            std::swap(a, b);
+        t0 = std::max(t0, a);
+        t1 = std::min(t1, b);
+    }
+    return t0 < t1;
+}
+
+/**
+ * Integrates the ray from start to end over intervals steps and returns the
+ * radiance; transmittance receives the fraction of light that gets through
+ * and reached the last grid point integrated before the transmittance fell
+ * below threshold.
+ */
+template<typename Real>
+Real integrate_segment(const CGageAdaptor& image,
+                       const TransferFunction<Real>& color,
+                       const TransferFunction<Real>& transparency,
+                       const RenderSettings<Real>& settings,
+                       Integrator<Real>& integrator,
+                       const Real *start, const Real *end, unsigned intervals,
+                       const Real *light, Real threshold,
+                       Real& transmittance, unsigned& reached, size_t& samples)
+{
+    Volume_solution<Real> solve(start, end, image, color, transparency);
+    if(settings.shading)
+        solve.shade(light);
+
+    if(settings.outer_method == ADAPTIVE_RK)
+    {
+        // The adaptive steps fall off the grid, every sample is probed.
+        // Mixed cells can have features as thin as a voxel anywhere, steps
+        // there are at most the step size. They only grow past it across
+        // the uniform cells.
+        std::vector< std::pair<Real, Real> > uniform;
+        if(settings.uniform)
+        {
+            const Real dir[3] = {end[0] - start[0], end[1] - start[1], end[2] - start[2]};
+            settings.uniform->uniform_segments(start, dir, Real(0.0), Real(1.0), uniform);
+        }
+        Real l = 0.0;
+        Real I = outer_adaptive(solve, Real(1.0), Real(1.0) / intervals, Real(1.0) / intervals, settings.tolerance,
+                                threshold, &transmittance, &l, (size_t*)0, &uniform);
+        reached = l < 1.0 ? unsigned(l * intervals) : intervals;
+        samples += solve.m_probes;
+        return I;
+    }
+
+    // Without the normal cache, shaded samples take value and normal from
+    // one gage probe each; the batched probes only give values.
+    if(!settings.shading or image.GetNormalCacheSize() > 0)
+    {
+        // SIMPSON also samples the midpoints of the intervals.
+        if(settings.inner_method == SIMPSON)
+            solve.prefetch(Real(0.5) / intervals, 2 * intervals + 1);
+        else
+            solve.prefetch(Real(1.0) / intervals, intervals + 1);
+    }
+
+    if(settings.outer_method == PRE_INTEGRATED)
+    {
+        // One table fetch per interval between consecutive grid values.
+        const Real d = solve.m_length / intervals;
+        CompensatedSum<Real> I;
+        Real T = 1.0;
+        Real front = solve.value(0.0);
+        Real front_shade = solve.m_last_shade;
+        reached = intervals;
+        for(unsigned k = 1; k <= intervals; ++k)
+        {
+            const Real back = solve.value(Real(k) / intervals);
+            Real color, opacity;
+            settings.pre_table->fetch(front, back, d, color, opacity);
+            I += T * color * 0.5 * (front_shade + solve.m_last_shade);
+            T *= 1.0 - opacity;
+            front = back;
+            front_shade = solve.m_last_shade;
+            if(threshold > 0.0 and T < threshold)
+            {
+                reached = k;
+                break;
+            }
+        }
+        transmittance = T;
+        samples += solve.m_probes;
+        return I.value();
+    }
+
+    std::vector<Real> no_samples;
+    Real I = integrator.outer(solve, Real(1.0) / intervals, intervals + 1,
+                              settings.outer_method, settings.inner_method, settings.exp_method,
+                              no_samples, threshold, &transmittance, &reached);
+
+    samples += solve.m_probes;
+    return I;
+}
+
+template<typename Real>
+Real cast_ray(const CGageAdaptor& image,
+              const TransferFunction<Real>& color,
+              const TransferFunction<Real>& transparency,
+              const RenderSettings<Real>& settings,
+              Integrator<Real>& integrator,
+              const Real *origin, const Real *dir, ThreadStats& stats)
+{
+    Real t0, t1;
+    if(!clip_ray(image, origin, dir, t0, t1))
+        return 0.0;
+
+    // SIMPSON and BOOLE need the number of intervals to be a multiple of 4.
+    unsigned intervals = unsigned(std::ceil((t1 - t0) / settings.step));
+    intervals = std::max(4u, (intervals + 3u) & ~3u);
+
+    const Real light[3] = {-dir[0], -dir[1], -dir[2]};
+    Real start[3], end[3];
+    Real transmittance = 1.0;
+    unsigned reached = 0;
+
+    if(!settings.empty_space)
+    {
+        for(unsigned i = 0; i < 3; ++i)
+        {
+            start[i] = origin[i] + t0 * dir[i];
+            end[i]   = origin[i] + t1 * dir[i];
+        }
+        const Real I = integrate_segment(image, color, transparency, settings, integrator, start, end,
+                                         intervals, light, settings.termination,
+                                         transmittance, reached, stats.samples);
+        if(reached < intervals)
+        {
+            ++stats.terminated;
+            stats.depth += Real(reached) / intervals;
+        }
+        return I;
+    }
+
+    // Only the grid points around the non-empty cells are integrated. Each
+    // run starts and ends on a multiple of 4 of the grid of the whole ray,
+    // so the stencils are the same, and is padded with one point on each
+    // side. The points left out and the padding are in empty cells where
+    // both the emission and the extinction vanish, so the runs composite
+    // front to back into the integral over the whole ray.
+    std::vector< std::pair<Real, Real> > ranges;
+    settings.empty_space->segments(origin, dir, t0, t1, ranges);
+
+    const Real scale = intervals / (t1 - t0);
+    std::vector< std::pair<unsigned, unsigned> > runs;
+    for(const std::pair<Real, Real>& range : ranges)
+    {
+        const Real a = std::floor((range.first  - t0) * scale) - 1.0;
+        const Real b = std::ceil ((range.second - t0) * scale) + 1.0;
+        const unsigned k0 = a <= 0.0 ? 0u : unsigned(a) & ~3u;
+        const unsigned k1 = std::min(intervals, (unsigned(std::max(b, Real(0.0))) + 3u) & ~3u);
+        if(k1 <= k0)
+            continue;
+        if(!runs.empty() and runs.back().second >= k0)
+            runs.back().second = std::max(runs.back().second, k1);
+        else
+            runs.push_back(std::make_pair(k0, k1));
+    }
+
+    Real I = 0.0;
+    Real T = 1.0;
+    for(const std::pair<unsigned, unsigned>& run : runs)
+    {
+        const Real l0 = t0 + run.first  / scale;
+        const Real l1 = t0 + run.second / scale;
+        for(unsigned i = 0; i < 3; ++i)
+        {
+            start[i] = origin[i] + l0 * dir[i];
+            end[i]   = origin[i] + l1 * dir[i];
+        }
+        // The threshold applies to the transmittance of the whole ray.
+        I += T * integrate_segment(image, color, transparency, settings, integrator, start, end,
+                                   run.second - run.first, light,
+                                   settings.termination > 0.0 ? settings.termination / T : Real(0.0),
+                                   transmittance, reached, stats.samples);
+        T *= transmittance;
+        if(run.first + reached < run.second)
+        {
+            ++stats.terminated;
+            stats.depth += Real(run.first + reached) / intervals;
+            break;
+        }
+    }
+
+    return I;
+}
+
+/**
+ * Casts one ray per pixel through the volume and stores the integrated
+ * radiance in pixels (row-major, width * height). The image is split in
+ * square tiles that are distributed over one thread per entry of images;
+ * every thread probes its own adaptor.
+ */
+template<typename Real>
+RenderStats render(const std::vector< boost::shared_ptr<CGageAdaptor> >& images,
+                   const TransferFunction<Real>& color,
+                   const TransferFunction<Real>& transparency,
+                   const Camera<Real>& camera,
+                   const RenderSettings<Real>& settings,
+                   std::vector<float>& pixels)
+{
+    RenderStats stats = {0, 0, 0, 0.0, 0.0, std::vector<ThreadStats>()};
+    pixels.assign(camera.m_width * camera.m_height, 0.0f);
+
+    const unsigned tile_size = settings.tile_size;
+    const unsigned tiles_x = (camera.m_width  + tile_size - 1) / tile_size;
+    const unsigned tiles_y = (camera.m_height + tile_size - 1) / tile_size;
+
+    // The integration state of the ray in progress, reused by the rays of
+    // each thread.
+    std::vector< Integrator<Real> > integrators(images.size());
+
+    auto work = [&](unsigned thread, unsigned tile, ThreadStats& s)
+    {
+        const CGageAdaptor& image = *images[thread];
+        Integrator<Real>& integrator = integrators[thread];
+        const unsigned x0 = (tile % tiles_x) * tile_size;
+        const unsigned y0 = (tile / tiles_x) * tile_size;
+        const unsigned x1 = std::min(x0 + tile_size, camera.m_width);
+        const unsigned y1 = std::min(y0 + tile_size, camera.m_height);
+        for(unsigned j = y0; j < y1; ++j)
+        {
+            for(unsigned i = x0; i < x1; ++i)
+            {
+                Real dir[3];
+                camera.ray(i, j, dir);
+                pixels[j * camera.m_width + i] =
+                        float(cast_ray(image, color, transparency, settings, integrator, camera.m_eye, dir, s));
+                ++s.rays;
+            }
+        }
+    };
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    run_tiles(tiles_x * tiles_y, unsigned(images.size()), work, stats.threads);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for(const ThreadStats& s : stats.threads)
+    {
+        stats.rays += s.rays;
+        stats.samples += s.samples;
+        stats.terminated += s.terminated;
+        stats.depth += s.depth;
+    }
+
+    return stats;
+}
+
+#endif // RENDER_H
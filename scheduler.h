@@ -0,0 +1,121 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+/**
+ * Per-worker counters filled in by run_tiles.
+ */
+struct ThreadStats
+{
+    ThreadStats() : tiles(0), steals(0), rays(0), samples(0), terminated(0), depth(0.0), busy(0.0), seconds(0.0)
+    {
+    }
+
+    size_t tiles;
+    size_t steals;
+    size_t rays;
+    size_t samples;
+    // Rays stopped by early termination, and the sum over them of the
+    // fraction of their length that was integrated.
+    size_t terminated;
+    double depth;
+    // Time spent processing tiles and total time until the worker ran out
+    // of work, in seconds.
+    double busy;
+    double seconds;
+};
+
+/**
+ * Double ended queue of tile indices. The owner takes tiles from the front,
+ * thieves take them from the back, so the owner keeps working on tiles that
+ * are next to each other in the image.
+ */
+class TileQueue
+{
+public:
+    void push(unsigned tile)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tiles.push_back(tile);
+    }
+    bool pop(unsigned& tile)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_tiles.empty())
+            return false;
+        tile = m_tiles.front();
+        m_tiles.pop_front();
+        return true;
+    }
+    bool steal(unsigned& tile)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_tiles.empty())
+            return false;
+        tile = m_tiles.back();
+        m_tiles.pop_back();
+        return true;
+    }
+private:
+    std::mutex m_mutex;
+    std::deque<unsigned> m_tiles;
+};
+
+/**
+ * Runs work(thread, tile, stats) for every tile in [0, tiles) on the given
+ * number of threads. Each thread starts with a contiguous block of tiles and
+ * steals from the other queues once its own is empty. All the tiles are
+ * queued up front, so a thread that finds every queue empty is done.
+ */
+template<typename Work>
+void run_tiles(unsigned tiles, unsigned threads, Work work, std::vector<ThreadStats>& stats)
+{
+    threads = std::max(1u, threads);
+    std::vector<TileQueue> queues(threads);
+    for(unsigned t = 0; t < threads; ++t)
+        for(unsigned tile = t * tiles / threads; tile < (t+1) * tiles / threads; ++tile)
+            queues[t].push(tile);
+
+    stats.assign(threads, ThreadStats());
+
+    auto worker = [&](unsigned t)
+    {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point begin = clock::now();
+        ThreadStats& s = stats[t];
+
+        unsigned tile;
+        for(;;)
+        {
+            bool found = queues[t].pop(tile);
+            for(unsigned k = 1; !found and k < threads; ++k)
+            {
+                found = queues[(t+k) % threads].steal(tile);
+                s.steals += found;
+            }
+            if(!found)
+                break;
+
+            clock::time_point tile_begin = clock::now();
+            work(t, tile, s);
+            s.busy += std::chrono::duration<double>(clock::now() - tile_begin).count();
+            ++s.tiles;
+        }
+        s.seconds = std::chrono::duration<double>(clock::now() - begin).count();
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned t = 1; t < threads; ++t)
+        pool.push_back(std::thread(worker, t));
+    worker(0);
+    for(std::thread& thread : pool)
+        thread.join();
+}
+
+#endif // SCHEDULER_H
@@ -0,0 +1,263 @@
+#ifndef SHARED_SAMPLES_H
+#define SHARED_SAMPLES_H
+
+#include <vector>
+#include <algorithm>
+
+#include "solutions.h"
+#include "integration.h"
+
+/**
+ * T and C of the solution S sampled once along a ray of n grid points
+ * i * d, for integrating it with several combinations of methods. The outer
+ * rules read the grid points, the inner rules read the grid points, the
+ * midpoints (SIMPSON) and the nodes of the Gauss methods in every interval,
+ * and the outer Gauss rules read C and T at their nodes. sample()
+ * evaluates those the given combinations need, in batches. The samples are
+ * only read afterwards: threads integrate the combinations in parallel,
+ * through one Shared_solution each.
+ */
+template<typename Real, typename S>
+struct Shared_samples
+{
+    Shared_samples(const S &solve, Real d, unsigned n) :
+        m_solve(solve), m_d(d), m_n(n), m_grid(Real(n - 1) * d, d * 0.5), m_evaluations(0)
+    {
+    }
+
+    void sample(const std::vector<DynamicMethods>& combinations)
+    {
+        bool midpoints = false;
+        std::vector<Method> inners, outers;
+        for(const DynamicMethods& m : combinations)
+        {
+            midpoints = midpoints or m.inner == SIMPSON;
+            if(is_gauss(m.inner))
+                inners.push_back(m.inner);
+            if(is_gauss(m.outer))
+                outers.push_back(m.outer);
+        }
+
+        // Grid points at even k * h, midpoints at odd k.
+        std::vector<Real> l;
+        for(unsigned k = 0; k < 2 * m_n - 1; k += midpoints ? 1 : 2)
+            l.push_back(k * m_grid.m_h);
+        evaluate_T(l);
+        l.clear();
+        for(unsigned i = 0; i < m_n; ++i)
+            l.push_back(i * m_d);
+        evaluate_C(l);
+
+        // The Gauss nodes of every interval, computed as inner() and the
+        // outer Gauss rules compute them, where the grid has nothing yet.
+        std::vector<Node> nodes;
+        add_nodes(inners, 1, nodes);
+        add_nodes(outers, 3, nodes);
+        std::sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return a.l < b.l; });
+        m_nodes.clear();
+        for(const Node& node : nodes)
+        {
+            if(!m_nodes.empty() and m_nodes.back().l == node.l)
+                m_nodes.back().known |= node.known;
+            else
+                m_nodes.push_back(node);
+        }
+
+        std::vector<Real> lt, lc;
+        for(const Node& node : m_nodes)
+        {
+            if(node.known & 1)
+                lt.push_back(node.l);
+            if(node.known & 2)
+                lc.push_back(node.l);
+        }
+        std::vector<Real> t(lt.size()), c(lc.size());
+        if(!lt.empty())
+            m_solve.T(&lt[0], &t[0], lt.size());
+        if(!lc.empty())
+            m_solve.C(&lc[0], &c[0], lc.size());
+        m_evaluations += t.size() + c.size();
+        size_t kt = 0, kc = 0;
+        for(Node& node : m_nodes)
+        {
+            if(node.known & 1)
+                node.t = t[kt++];
+            if(node.known & 2)
+                node.c = c[kc++];
+        }
+    }
+
+    // T or C at l when sampled, or null.
+    inline const Real *T(Real l) const
+    {
+        if(const Real *t = m_grid.T(l))
+            return t;
+        const Node *node = find(l);
+        return node and (node->known & 1) ? &node->t : 0;
+    }
+    inline const Real *C(Real l) const
+    {
+        if(const Real *c = m_grid.C(l))
+            return c;
+        const Node *node = find(l);
+        return node and (node->known & 2) ? &node->c : 0;
+    }
+
+    // Evaluations of T and C of S by sample().
+    size_t evaluations() const
+    {
+        return m_evaluations;
+    }
+
+    const S &m_solve;
+    Real m_d;
+    unsigned m_n;
+
+private:
+    // A Gauss node off the grid. Bit 0 of known: t is known, bit 1: c is.
+    struct Node
+    {
+        Real l;
+        Real t;
+        Real c;
+        unsigned char known;
+    };
+
+    void evaluate_T(const std::vector<Real>& l)
+    {
+        std::vector<Real> t(l.size());
+        m_solve.T(&l[0], &t[0], l.size());
+        for(size_t k = 0; k < l.size(); ++k)
+            m_grid.set_T(l[k], t[k]);
+        m_evaluations += t.size();
+    }
+    void evaluate_C(const std::vector<Real>& l)
+    {
+        std::vector<Real> c(l.size());
+        m_solve.C(&l[0], &c[0], l.size());
+        for(size_t k = 0; k < l.size(); ++k)
+            m_grid.set_C(l[k], c[k]);
+        m_evaluations += c.size();
+    }
+
+    // Adds the nodes of the Gauss methods, asking for T (bit 0) and C
+    // (bit 1) of known.
+    void add_nodes(const std::vector<Method>& methods, unsigned char known, std::vector<Node>& nodes) const
+    {
+        std::vector<const Real *> added;
+        for(Method m : methods)
+        {
+            const GaussRule<Real> gauss = gauss_rule<Real>(m);
+            if(std::find(added.begin(), added.end(), gauss.nodes) != added.end())
+                continue;
+            added.push_back(gauss.nodes);
+
+            for(unsigned i = 1; i < m_n; ++i)
+            {
+                const Real a = (i-1)*m_d;
+                const Real b = i*m_d;
+                for(unsigned j = 0; j < gauss.points; ++j)
+                {
+                    Node node = {gauss_node(a, b, gauss.nodes[j]), 0.0, 0.0, 0};
+                    if((known & 1) and !m_grid.T(node.l))
+                        node.known |= 1;
+                    if((known & 2) and !m_grid.C(node.l))
+                        node.known |= 2;
+                    if(node.known)
+                        nodes.push_back(node);
+                }
+            }
+        }
+    }
+
+    inline const Node *find(Real l) const
+    {
+        typename std::vector<Node>::const_iterator node =
+            std::lower_bound(m_nodes.begin(), m_nodes.end(), l, [](const Node& a, Real b) { return a.l < b; });
+        return node != m_nodes.end() and node->l == l ? &*node : 0;
+    }
+
+    GridCache<Real> m_grid;
+    // Sorted by l.
+    std::vector<Node> m_nodes;
+    size_t m_evaluations;
+};
+
+/**
+ * The solution S read from its Shared_samples, and evaluated at the points
+ * they do not have, such as the MONTE_CARLO positions and the nodes of the
+ * inner panels of the outer Gauss rules, which only one combination reads.
+ * One per thread.
+ */
+template<typename Real, typename S>
+struct Shared_solution : public Static_solution<Shared_solution<Real, S>, Real>
+{
+    typedef Static_solution<Shared_solution<Real, S>, Real> Base;
+    using Base::T;
+    using Base::C;
+
+    explicit Shared_solution(const Shared_samples<Real, S>& samples) :
+        Base(samples.m_solve.m_start, samples.m_solve.m_end), m_samples(samples),
+        m_evaluations(0), m_requests(0)
+    {
+    }
+
+    inline Real sol(Real l) const
+    {
+        return m_samples.m_solve.sol(l);
+    }
+    inline Real T(Real l) const
+    {
+        ++m_requests;
+        if(const Real *t = m_samples.T(l))
+            return *t;
+        ++m_evaluations;
+        return m_samples.m_solve.T(l);
+    }
+    inline Real C(Real l) const
+    {
+        ++m_requests;
+        if(const Real *c = m_samples.C(l))
+            return *c;
+        ++m_evaluations;
+        return m_samples.m_solve.C(l);
+    }
+
+    // Evaluations of T and C of S past the samples, and of this solution.
+    size_t evaluations() const
+    {
+        return m_evaluations;
+    }
+    size_t requests() const
+    {
+        return m_requests;
+    }
+
+    const Shared_samples<Real, S>& m_samples;
+    mutable size_t m_evaluations;
+    mutable size_t m_requests;
+};
+
+/**
+ * Integrates the emission over the sampled grid points with every
+ * combination of methods, into results. samples are the MONTE_CARLO
+ * positions of each combination, empty for the other inner methods. Returns
+ * the evaluations of T and C of S past the shared samples.
+ */
+template<typename Real, typename S>
+size_t outer_shared(Integrator<Real>& integrator, const Shared_samples<Real, S>& shared,
+                    const std::vector<DynamicMethods>& combinations,
+                    const std::vector< std::vector<Real> >& samples,
+                    std::vector<Real>& results)
+{
+    Shared_solution<Real, S> solve(shared);
+    results.resize(combinations.size());
+    for(size_t k = 0; k < combinations.size(); ++k)
+    {
+        const DynamicMethods& m = combinations[k];
+        results[k] = integrator.outer(solve, shared.m_d, shared.m_n, m.outer, m.inner, m.exp, samples[k]);
+    }
+    return solve.evaluations();
+}
+
+#endif // SHARED_SAMPLES_H
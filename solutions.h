@@ -3,6 +3,12 @@
 
 #include <numeric>
 #include <cmath>
+#include <cstddef>
+#include <cassert>
+#include <vector>
+#include <limits>
+
+#include "precision.h"
 
 const long double PI = std::atan(1.0)*4.0;
 
@@ -18,10 +24,20 @@ real magnitue(const real *v)
     return std::sqrt(std::inner_product(v+0, v+3, v+0, real(0.0)));
 }
 
-template<typename Real>
-struct Solution
+/**
+ * Base of the analytic and sampled solutions, dispatched statically.
+ * Derived provides T, C and whichever other hooks it supports as plain
+ * members; the integration kernels call them on the concrete type, so they
+ * can be inlined.
+ *
+ * The batch T and C evaluate a whole array of ray parameters, and emission
+ * the product C T the outer integral sums. Derived classes bring the batch
+ * overloads in next to their scalar T and C with using declarations.
+ */
+template<typename Derived, typename Real>
+struct Static_solution
 {
-    Solution(const Real *start, const Real *end)
+    Static_solution(const Real *start, const Real *end)
     {
         for(unsigned i = 0; i < 3; ++i)
         {
@@ -31,17 +47,40 @@ struct Solution
         }
     }
 
-    virtual inline Real sol(Real) const { assert(0); return Real(0.0); }
-    virtual inline Real sol_vri(Real) const { assert(0); return Real(0.0); }
-    virtual inline Real s(const Point<Real>&) const { assert(0); return Real(0.0); }
-    virtual inline Real emission_1st(const Point<Real>&) const { assert(0); return Real(0.0); }
-    virtual inline Real emission_2nd(const Point<Real>&) const { assert(0); return Real(0.0); }
-    virtual inline Real emission_2nd_approx(const Point<Real>&) const { assert(0); return Real(0.0); }
-    virtual inline Real attenuation_1st(const Point<Real>&) const { assert(0); return Real(0.0); }
-    virtual inline Real attenuation_2nd(const Point<Real>&) const { assert(0); return Real(0.0); }
-    virtual inline Real T(Real) const { assert(0); return Real(0.0); }
-    virtual inline Real C(Real) const { assert(0); return Real(0.0); }
-    virtual inline Point<Real> X(Real lambda) const
+    inline const Derived& derived() const
+    {
+        return static_cast<const Derived&>(*this);
+    }
+
+    inline Real sol(Real) const { assert(0); return Real(0.0); }
+    inline Real sol_vri(Real) const { assert(0); return Real(0.0); }
+    inline Real s(const Point<Real>&) const { assert(0); return Real(0.0); }
+    inline Real emission_1st(const Point<Real>&) const { assert(0); return Real(0.0); }
+    inline Real emission_2nd(const Point<Real>&) const { assert(0); return Real(0.0); }
+    inline Real emission_2nd_approx(const Point<Real>&) const { assert(0); return Real(0.0); }
+    inline Real attenuation_1st(const Point<Real>&) const { assert(0); return Real(0.0); }
+    inline Real attenuation_2nd(const Point<Real>&) const { assert(0); return Real(0.0); }
+    inline Real T(Real) const { assert(0); return Real(0.0); }
+    inline Real C(Real) const { assert(0); return Real(0.0); }
+
+    inline void T(const Real *l, Real *out, size_t n) const
+    {
+        for(size_t i = 0; i < n; ++i)
+            out[i] = derived().T(l[i]);
+    }
+    inline void C(const Real *l, Real *out, size_t n) const
+    {
+        for(size_t i = 0; i < n; ++i)
+            out[i] = derived().C(l[i]);
+    }
+    inline void emission(const Real *l, Real *out, size_t n) const
+    {
+        T(l, out, n);
+        for(size_t i = 0; i < n; ++i)
+            out[i] = derived().C(l[i]) * out[i];
+    }
+
+    inline Point<Real> X(Real lambda) const
     {
         Point<Real> x;
         x.x = m_start[0] + lambda*m_step[0];
@@ -56,10 +95,14 @@ struct Solution
 };
 
 template<typename Real>
-struct VRI_solution_00 : public Solution<Real>
+struct VRI_solution_00 : public Static_solution<VRI_solution_00<Real>, Real>
 {
+    typedef Static_solution<VRI_solution_00<Real>, Real> Base;
+    using Base::T;
+    using Base::C;
+
     VRI_solution_00(const Real *start, const Real *end) :
-        Solution<Real>::Solution(start, end)
+        Base(start, end)
     {
     }
     inline Real sol(Real l) const
@@ -72,18 +115,29 @@ struct VRI_solution_00 : public Solution<Real>
     }
     inline Real T(Real l) const
     {
-        return s(this->X(l))*cos(s(this->X(l))*s(this->X(l)));
+        const Real x = s(this->X(l));
+        return x*cos(x*x);
     }
     inline Real C(Real l) const
     {
-        return sin(s(this->X(l))*s(this->X(l)));
+        const Real x = s(this->X(l));
+        return sin(x*x);
     }
 };
 
 
 template<typename Real>
-struct VRI_solution_01 : public Solution<Real>
+struct VRI_solution_01 : public Static_solution<VRI_solution_01<Real>, Real>
 {
+    typedef Static_solution<VRI_solution_01<Real>, Real> Base;
+    using Base::T;
+    using Base::C;
+
+    VRI_solution_01(const Real *start, const Real *end) :
+        Base(start, end)
+    {
+    }
+
     inline Real sol(Real l) const
     {
         return -exp(-l)*( atan(sin(l)/cos(l))-exp(l)+1 );
@@ -98,13 +152,22 @@ struct VRI_solution_01 : public Solution<Real>
     }
     inline Real C(Real l) const
     {
-        return atan(s(X(l)));
+        return atan(s(this->X(l)));
     }
 };
 
 template<typename Real>
-struct VRI_solution_02 : public Solution<Real>
+struct VRI_solution_02 : public Static_solution<VRI_solution_02<Real>, Real>
 {
+    typedef Static_solution<VRI_solution_02<Real>, Real> Base;
+    using Base::T;
+    using Base::C;
+
+    VRI_solution_02(const Real *start, const Real *end) :
+        Base(start, end)
+    {
+    }
+
     inline Real sol(Real l) const
     {
         return 1-exp(-sin(l))*(sin(l)+1);
@@ -117,18 +180,27 @@ struct VRI_solution_02 : public Solution<Real>
 
     inline Real T(Real l) const
     {
-        return cos(s(X(l)));
+        return cos(s(this->X(l)));
     }
 
     inline Real C(Real l) const
     {
-        return sin(s(X(l)));
+        return sin(s(this->X(l)));
     }
 };
 
 template<typename Real>
-struct VRI_solution_03 : public Solution<Real>
+struct VRI_solution_03 : public Static_solution<VRI_solution_03<Real>, Real>
 {
+    typedef Static_solution<VRI_solution_03<Real>, Real> Base;
+    using Base::T;
+    using Base::C;
+
+    VRI_solution_03(const Real *start, const Real *end) :
+        Base(start, end)
+    {
+    }
+
     inline Real sol(Real l) const
     {
         return 1.0-exp(-l);
@@ -150,8 +222,17 @@ struct VRI_solution_03 : public Solution<Real>
     }
 };
 template<typename Real>
-struct Exp_solution_00 : public Solution<Real>
+struct Exp_solution_00 : public Static_solution<Exp_solution_00<Real>, Real>
 {
+    typedef Static_solution<Exp_solution_00<Real>, Real> Base;
+    using Base::T;
+    using Base::C;
+
+    Exp_solution_00(const Real *start, const Real *end) :
+        Base(start, end)
+    {
+    }
+
     mutable Real d = std::numeric_limits<Real>::infinity();
     inline Real sol(Real l) const
     {
@@ -185,15 +266,19 @@ struct Exp_solution_00 : public Solution<Real>
     }
     inline Real T(Real l) const
     {
-        return s(X(l));
+        return s(this->X(l));
     }
 };
 
 template<typename Real>
-struct Exp_solution_02 : public Solution<Real>
+struct Exp_solution_02 : public Static_solution<Exp_solution_02<Real>, Real>
 {
+    typedef Static_solution<Exp_solution_02<Real>, Real> Base;
+    using Base::T;
+    using Base::C;
+
     Exp_solution_02(const Real *start, const Real *end) :
-        Solution<Real>::Solution(start, end)
+        Base(start, end)
     {
     }
 
@@ -281,4 +366,132 @@ struct Exp_solution_02 : public Solution<Real>
     }
 };
 
+/**
+ * T and C cached at the points k * h of a grid over [0, length]. The grids
+ * of the convergence levels are i * d with d a power of two multiple of h,
+ * and the midpoints (j - 0.5) * d the SIMPSON inner method asks for are odd
+ * multiples of h when h divides d / 2, so their parameters are k * h
+ * exactly. Parameters off the grid are never cached.
+ */
+template<typename Real>
+struct GridCache
+{
+    GridCache(Real length, Real h) :
+        m_h(h), m_T(size_t(length / h + 0.5) + 1), m_C(m_T.size()), m_known(m_T.size(), 0)
+    {
+    }
+
+    // T or C at l, null when l is off the grid or not cached yet.
+    inline const Real *T(Real l) const
+    {
+        size_t k;
+        return point(l, k) and (m_known[k] & 1) ? &m_T[k] : 0;
+    }
+    inline const Real *C(Real l) const
+    {
+        size_t k;
+        return point(l, k) and (m_known[k] & 2) ? &m_C[k] : 0;
+    }
+
+    // Caches T or C at l, when l is on the grid.
+    inline void set_T(Real l, Real t)
+    {
+        size_t k;
+        if(point(l, k))
+        {
+            m_T[k] = t;
+            m_known[k] |= 1;
+        }
+    }
+    inline void set_C(Real l, Real c)
+    {
+        size_t k;
+        if(point(l, k))
+        {
+            m_C[k] = c;
+            m_known[k] |= 2;
+        }
+    }
+
+    Real m_h;
+    std::vector<Real> m_T;
+    std::vector<Real> m_C;
+    // Bit 0: m_T is known, bit 1: m_C is known.
+    std::vector<unsigned char> m_known;
+
+private:
+    // Whether l is the grid point k.
+    inline bool point(Real l, size_t& k) const
+    {
+        const Real x = l / m_h + 0.5;
+        if(!(x >= 0.0) or x >= Real(m_T.size()))
+            return false;
+        k = size_t(x);
+        return Real(k) * m_h == l;
+    }
+};
+
+/**
+ * Caches T and C of the solution S at the points of a grid of step h over
+ * [0, length], for the convergence checks that refine a grid by halving its
+ * step down to h. The points of every coarser grid, and the midpoints the
+ * SIMPSON inner method asks for, are points of the finer ones, so each level
+ * only evaluates the points the coarser levels did not. The parameters off
+ * the grid, such as Gauss nodes and MONTE_CARLO positions, go to S. Not
+ * thread-safe.
+ */
+template<typename Real, typename S>
+struct Nested_solution : public Static_solution<Nested_solution<Real, S>, Real>
+{
+    typedef Static_solution<Nested_solution<Real, S>, Real> Base;
+    using Base::T;
+    using Base::C;
+
+    Nested_solution(const S &solve, Real length, Real h) :
+        Base(solve.m_start, solve.m_end), m_solve(solve), m_grid(length, h),
+        m_evaluations(0), m_requests(0)
+    {
+    }
+
+    inline Real sol(Real l) const
+    {
+        return m_solve.sol(l);
+    }
+    inline Real T(Real l) const
+    {
+        ++m_requests;
+        if(const Real *t = m_grid.T(l))
+            return *t;
+        const Real t = m_solve.T(l);
+        m_grid.set_T(l, t);
+        ++m_evaluations;
+        return t;
+    }
+    inline Real C(Real l) const
+    {
+        ++m_requests;
+        if(const Real *c = m_grid.C(l))
+            return *c;
+        const Real c = m_solve.C(l);
+        m_grid.set_C(l, c);
+        ++m_evaluations;
+        return c;
+    }
+
+    // Evaluations of T and C of S so far, and of this solution.
+    size_t evaluations() const
+    {
+        return m_evaluations;
+    }
+    size_t requests() const
+    {
+        return m_requests;
+    }
+
+    const S &m_solve;
+    mutable GridCache<Real> m_grid;
+    mutable size_t m_evaluations;
+    mutable size_t m_requests;
+};
+
 #endif // SOLUTIONS_H
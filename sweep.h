@@ -0,0 +1,294 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <tr1/random>
+
+#include "solutions.h"
+#include "integration.h"
+#include "scheduler.h"
+#include "shared_samples.h"
+
+/**
+ * One refinement level of one method combination of a sweep. ADAPTIVE_RK
+ * uses neither an inner nor an exponential method; its levels divide the
+ * tolerance by 10 instead of halving the step.
+ */
+struct SweepResult
+{
+    Method outer;
+    Method inner;
+    Method exp;
+    unsigned level;
+    // Grid step, the initial step for ADAPTIVE_RK.
+    double step;
+    // ADAPTIVE_RK only, 0 otherwise.
+    double tolerance;
+    double error;
+    // Grid points, evaluations of C and T for ADAPTIVE_RK.
+    size_t samples;
+    double seconds;
+};
+
+/**
+ * Methods of a comma-separated list, or every method of all for "all".
+ */
+inline
+std::vector<Method> getMethods(const std::string &list, const Method *all, unsigned count)
+{
+    if(list == "all")
+        return std::vector<Method>(all, all + count);
+
+    std::vector<Method> methods;
+    size_t begin = 0;
+    while(begin <= list.size())
+    {
+        const size_t end = std::min(list.find(',', begin), list.size());
+        methods.push_back(getMethod(list.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+    return methods;
+}
+
+/**
+ * levels results for every combination of the listed methods the specialized
+ * kernels support, in that order, and for ADAPTIVE_RK when it is one of the
+ * outer methods.
+ */
+template<typename Real>
+std::vector<SweepResult> sweep_tasks(const std::vector<Method>& outers,
+                                     const std::vector<Method>& inners,
+                                     const std::vector<Method>& exps,
+                                     unsigned levels)
+{
+    typedef OuterKernels< Real, VRI_solution_00<Real> > Kernels;
+
+    std::vector<SweepResult> tasks;
+    for(Method o : outers)
+    {
+        if(o == ADAPTIVE_RK)
+        {
+            for(unsigned level = 0; level < levels; ++level)
+            {
+                const SweepResult task = {o, o, o, level, 0.0, 0.0, 0.0, 0, 0.0};
+                tasks.push_back(task);
+            }
+            continue;
+        }
+        for(Method i : inners)
+        {
+            for(Method e : exps)
+            {
+                if(!Kernels::supports(o, i, e))
+                    continue;
+                for(unsigned level = 0; level < levels; ++level)
+                {
+                    const SweepResult task = {o, i, e, level, 0.0, 0.0, 0.0, 0, 0.0};
+                    tasks.push_back(task);
+                }
+            }
+        }
+    }
+    return tasks;
+}
+
+/**
+ * Fills in the tasks of sweep_tasks() on the given number of threads: every
+ * level integrates the analytic VRI_solution_00 over [0, 1] like the
+ * convergence check, with the step d halved level times, or with the
+ * tolerance divided by 10 level times for ADAPTIVE_RK. Each level samples
+ * the ray once, in Shared_samples, for all its combinations; they are then
+ * integrated through outer_shared() in chunks small enough to keep every
+ * thread busy, and the seconds of each include its share of the sampling.
+ * Each thread integrates with its own Integrator, and the MONTE_CARLO
+ * positions of each task come from a generator seeded with its index, so
+ * that the results do not depend on the number of threads. evaluations
+ * receives the evaluations of C and T of the whole sweep.
+ */
+template<typename Real>
+void sweep(const Real *start, const Real *end, Real d, Real tolerance,
+           std::vector<SweepResult>& tasks, unsigned threads, size_t *evaluations = 0)
+{
+    typedef Shared_samples< Real, VRI_solution_00<Real> > Samples;
+    const Real D = 1.0;
+    const VRI_solution_00<Real> solve(start, end);
+    const Real sol = solve.sol(D);
+    std::vector< Integrator<Real> > integrators(std::max(1u, threads));
+    std::vector<size_t> thread_evaluations(integrators.size(), 0);
+
+    // The tasks of each level, and the ADAPTIVE_RK ones.
+    std::vector< std::vector<size_t> > levels;
+    std::vector<size_t> adaptive;
+    for(size_t k = 0; k < tasks.size(); ++k)
+    {
+        if(tasks[k].outer == ADAPTIVE_RK)
+        {
+            adaptive.push_back(k);
+            continue;
+        }
+        size_t g = 0;
+        while(g < levels.size() and tasks[levels[g][0]].level != tasks[k].level)
+            ++g;
+        if(g == levels.size())
+            levels.push_back(std::vector<size_t>());
+        levels[g].push_back(k);
+    }
+
+    std::vector<Samples> shared;
+    shared.reserve(levels.size());
+    for(const std::vector<size_t>& members : levels)
+    {
+        Real h = d;
+        for(unsigned level = 0; level < tasks[members[0]].level; ++level)
+            h = h * 0.5;
+        shared.emplace_back(solve, h, unsigned((D / h) + 1));
+    }
+
+    std::vector<double> sampling(levels.size(), 0.0);
+    auto sample = [&](unsigned thread, unsigned level, ThreadStats&)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        std::vector<DynamicMethods> combinations;
+        for(size_t k : levels[level])
+            combinations.push_back(DynamicMethods(tasks[k].outer, tasks[k].inner, tasks[k].exp));
+        shared[level].sample(combinations);
+        thread_evaluations[thread] += shared[level].evaluations();
+        sampling[level] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+
+    std::vector<ThreadStats> stats;
+    run_tiles(unsigned(levels.size()), unsigned(integrators.size()), sample, stats);
+
+    // Chunks of the tasks of one level, or one ADAPTIVE_RK task. The levels
+    // are few and uneven, the chunks keep every thread busy.
+    struct Chunk
+    {
+        size_t level;
+        size_t begin;
+        size_t end;
+    };
+    const size_t size = std::max<size_t>(1, tasks.size() / (4 * integrators.size()));
+    std::vector<Chunk> chunks;
+    for(size_t level = 0; level < levels.size(); ++level)
+        for(size_t k = 0; k < levels[level].size(); k += size)
+        {
+            const Chunk chunk = {level, k, std::min(k + size, levels[level].size())};
+            chunks.push_back(chunk);
+        }
+    for(size_t k = 0; k < adaptive.size(); ++k)
+    {
+        const Chunk chunk = {levels.size(), k, k + 1};
+        chunks.push_back(chunk);
+    }
+
+    auto work = [&](unsigned thread, unsigned c, ThreadStats&)
+    {
+        const Chunk& chunk = chunks[c];
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if(chunk.level == levels.size())
+        {
+            SweepResult& r = tasks[adaptive[chunk.begin]];
+            Real tol = tolerance;
+            for(unsigned level = 0; level < r.level; ++level)
+                tol = tol * 0.1;
+
+            size_t count = 0;
+            const Real num = outer_adaptive(solve, D, d, D, tol, Real(0.0), (Real*)0, (Real*)0, &count);
+            r.step = double(d);
+            r.tolerance = double(tol);
+            r.samples = count;
+            r.error = double(fabs(sol - num));
+            r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            thread_evaluations[thread] += count;
+            return;
+        }
+
+        const std::vector<size_t> members(levels[chunk.level].begin() + chunk.begin,
+                                          levels[chunk.level].begin() + chunk.end);
+        const Samples& samples_of_level = shared[chunk.level];
+        const unsigned n = samples_of_level.m_n;
+
+        std::vector<DynamicMethods> combinations;
+        std::vector< std::vector<Real> > samples(members.size());
+        for(size_t k = 0; k < members.size(); ++k)
+        {
+            const SweepResult& r = tasks[members[k]];
+            combinations.push_back(DynamicMethods(r.outer, r.inner, r.exp));
+            if(r.inner == MONTE_CARLO)
+            {
+                std::tr1::subtract_with_carry_01<double, 48, 10, 24> gen(members[k] + 1);
+                std::tr1::uniform_real<> dis(0.0, D);
+                samples[k].resize(n);
+                for(Real& v : samples[k])
+                    v = dis(gen);
+                std::sort(samples[k].begin(), samples[k].end());
+            }
+        }
+
+        std::vector<Real> results;
+        thread_evaluations[thread] += outer_shared(integrators[thread], samples_of_level, combinations, samples, results);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        for(size_t k = 0; k < members.size(); ++k)
+        {
+            SweepResult& r = tasks[members[k]];
+            r.step = 1.0 / (n-1);
+            r.samples = n;
+            r.error = double(fabs(sol - results[k]));
+            r.seconds = seconds / members.size() + sampling[chunk.level] / levels[chunk.level].size();
+        }
+    };
+
+    run_tiles(unsigned(chunks.size()), unsigned(integrators.size()), work, stats);
+
+    if(evaluations)
+    {
+        *evaluations = 0;
+        for(size_t count : thread_evaluations)
+            *evaluations += count;
+    }
+}
+
+/**
+ * Writes the results of sweep() as one CSV row, or one JSON object, per
+ * result. The inner and exponential methods of ADAPTIVE_RK are empty.
+ */
+inline
+void write_sweep(std::ostream& out, const std::vector<SweepResult>& results,
+                 const char *precision, bool json)
+{
+    out << std::setprecision(17);
+    if(!json)
+        out << "precision,outer,inner,exp,level,step,tolerance,error,samples,seconds\n";
+    else
+        out << "[\n";
+
+    for(size_t k = 0; k < results.size(); ++k)
+    {
+        const SweepResult& r = results[k];
+        const bool adaptive = r.outer == ADAPTIVE_RK;
+        const char *inner = adaptive ? "" : getMethodName(r.inner);
+        const char *exp = adaptive ? "" : getMethodName(r.exp);
+        if(!json)
+            out << precision << "," << getMethodName(r.outer) << "," << inner << "," << exp << ","
+                << r.level << "," << r.step << "," << r.tolerance << "," << r.error << ","
+                << r.samples << "," << r.seconds << "\n";
+        else
+            out << "  {\"precision\": \"" << precision << "\", \"outer\": \"" << getMethodName(r.outer)
+                << "\", \"inner\": \"" << inner << "\", \"exp\": \"" << exp
+                << "\", \"level\": " << r.level << ", \"step\": " << r.step
+                << ", \"tolerance\": " << r.tolerance << ", \"error\": " << r.error
+                << ", \"samples\": " << r.samples << ", \"seconds\": " << r.seconds << "}"
+                << (k + 1 < results.size() ? ",\n" : "\n");
+    }
+
+    if(json)
+        out << "]\n";
+}
+
+#endif // SWEEP_H
@@ -0,0 +1,39 @@
+#ifndef TRANSFER_FUNCTION_H
+#define TRANSFER_FUNCTION_H
+
+#include <vector>
+
+/**
+ * 1D lookup table mapping a scalar value in [m_min, m_max] to a color or
+ * extinction coefficient. Values in between entries are linearly
+ * interpolated and values outside the domain are clamped.
+ */
+template<typename Real>
+struct TransferFunction
+{
+    TransferFunction() : m_min(0.0), m_max(1.0)
+    {
+    }
+
+    inline Real operator()(Real v) const
+    {
+        if(m_table.empty())
+            return Real(0.0);
+
+        Real t = (v - m_min) / (m_max - m_min) * (m_table.size() - 1);
+        if(t <= 0)
+            return m_table.front();
+        if(t >= m_table.size() - 1)
+            return m_table.back();
+
+        unsigned i = unsigned(t);
+        Real f = t - i;
+        return m_table[i] + f * (m_table[i+1] - m_table[i]);
+    }
+
+    std::vector<Real> m_table;
+    Real m_min;
+    Real m_max;
+};
+
+#endif // TRANSFER_FUNCTION_H
@@ -3,16 +3,50 @@ CONFIG += console
 CONFIG -= qt
 
 SOURCES += main.cpp \
-    GageAdaptor.cpp
+    GageAdaptor.cpp \
+    NativeSampler.cpp \
+    NormalCache.cpp \
+    BrickCache.cpp \
+    StreamingAdaptor.cpp \
+    MinMaxGrid.cpp
 
-QMAKE_CXXFLAGS += -std=c++11
+QMAKE_CXXFLAGS += -std=c++14
+# qmake CONFIG+=native tunes the build for the build host's CPU, which
+# enables the AVX2 reconstruction in NativeSampler.cpp there. The binary may
+# then not run on other machines.
+native {
+    QMAKE_CXXFLAGS += -march=native
+}
 QMAKE_LIBDIR += /usr/local/lib
 
-LIBS += -lboost_program_options-mt -lteem
+LIBS += -lboost_program_options-mt -lteem -lpthread
+
+# --precision quad, through libquadmath.
+*-g++* {
+    DEFINES += VRI_QUAD
+    LIBS += -lquadmath
+}
 
 HEADERS += \
+    precision.h \
     solutions.h \
     pre_integration.h \
+    pre_integration_table.h \
     integration.h \
+    gauss.h \
+    exponential.h \
     io.h \
-    GageAdaptor.h
+    GageAdaptor.h \
+    transfer_function.h \
+    render.h \
+    scheduler.h \
+    NativeSampler.h \
+    NormalCache.h \
+    BrickCache.h \
+    StreamingAdaptor.h \
+    MinMaxGrid.h \
+    empty_space.h \
+    benchmark.h \
+    sweep.h \
+    shared_samples.h \
+    extrapolation.h